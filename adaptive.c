@@ -0,0 +1,147 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "adaptive.h"
+
+// The clock is read this many times between the checks for the end of the run
+enum { adaptive_reads_per_check = 256 };
+
+// 97.5% quantiles of Student's t distribution for 1 to 31 degrees of freedom
+static double const t_quantiles[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    2.040
+};
+
+// For a two-sided 95% interval with the given degrees of freedom
+double adaptive_t_quantile(int const degrees_of_freedom) {
+    int const n = sizeof(t_quantiles) / sizeof(t_quantiles[0]);
+    if (degrees_of_freedom < 1) {
+        return INFINITY;
+    }
+    return (degrees_of_freedom <= n) ? t_quantiles[degrees_of_freedom - 1] : 1.96;
+}
+
+// Percentile p of total with the confidence interval from the nbr_batches
+// batches that total is made of
+void adaptive_estimate(struct histogram const *batches, int const nbr_batches, struct histogram const *total, double const p, struct adaptive_estimate *e) {
+    double sum = 0, sum_of_squares = 0;
+    for (int i = 0; i < nbr_batches; i++) {
+        double const v = (double) histogram_percentile(&batches[i], p);
+        sum += v;
+        sum_of_squares += v * v;
+    }
+    e->percentile = p;
+    e->value = histogram_percentile(total, p);
+    e->half_width = INT64_MAX;
+    e->relative_width = INFINITY;
+    if (nbr_batches < 2) {
+        return;
+    }
+    double const mean = sum / nbr_batches;
+    double variance = (sum_of_squares - nbr_batches * mean * mean) / (nbr_batches - 1);
+    if (variance < 0) {
+        variance = 0;
+    }
+    double const half_width = adaptive_t_quantile(nbr_batches - 1) * sqrt(variance / nbr_batches);
+    e->half_width = (int64_t) ceil(half_width);
+    if (e->value > 0) {
+        e->relative_width = half_width / (double) e->value;
+    } else if (half_width == 0) {
+        e->relative_width = 0;
+    }
+}
+
+static bool estimate_all(struct histogram const *batches, int const nbr_batches, struct adaptive_config const *config, struct adaptive_result *result) {
+    bool converged = nbr_batches >= adaptive_min_batches;
+    for (int i = 0; i < config->nbr_percentiles; i++) {
+        adaptive_estimate(batches, nbr_batches, &result->total, config->percentiles[i], &result->estimates[i]);
+        converged = converged && result->estimates[i].relative_width <= config->tolerance;
+    }
+    result->nbr_batches = nbr_batches;
+    result->converged = converged;
+    return converged;
+}
+
+// The time spent estimating between the batches is not counted as a diff.
+// callback, if not NULL, is called after every estimate.
+int clocktick_run_adaptive(struct clocktick_context const *context, struct adaptive_config const *config, struct adaptive_result *result, \
+                           adaptive_progress_callback callback, void *arg) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (!clocktick_units_in_ns(&ctx) && !ctx.cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    if (config->nbr_percentiles <= 0 || config->nbr_percentiles > adaptive_max_percentiles || config->tolerance <= 0 || config->duration_ns <= 0) {
+        return clocktick_error_argument;
+    }
+    double highest = 0;
+    for (int i = 0; i < config->nbr_percentiles; i++) {
+        if (config->percentiles[i] <= 0 || config->percentiles[i] >= 1) {
+            return clocktick_error_argument;
+        }
+        highest = (config->percentiles[i] > highest) ? config->percentiles[i] : highest;
+    }
+    struct histogram *batches = malloc(adaptive_nbr_batches * sizeof(struct histogram));
+    if (batches == NULL) {
+        return clocktick_error_system;
+    }
+    memset(result, 0, sizeof(*result));
+    histogram_init(&result->total);
+    uint64_t batch_reads = (uint64_t) ceil(adaptive_min_tail_samples / (1 - highest));
+    batch_reads = (batch_reads > config->min_batch_reads) ? batch_reads : config->min_batch_reads;
+    batch_reads = (batch_reads + adaptive_reads_per_check - 1) / adaptive_reads_per_check * adaptive_reads_per_check;
+    int nbr_batches = 0;
+
+    int64_t prev = clocktick_get_timevalue(&ctx), next;
+    int64_t const end = prev + clocktick_from_ns(&ctx, config->duration_ns);
+    while (prev < end) {
+        struct histogram *batch = &batches[nbr_batches];
+        histogram_init(batch);
+        while (batch->count < batch_reads && prev < end) {
+            for (int i = 0; i < adaptive_reads_per_check; i++) {
+                next = clocktick_get_timevalue(&ctx);
+                histogram_add(batch, next - prev);
+                prev = next;
+            }
+        }
+        histogram_merge(&result->total, batch);
+        result->nbr_reads = result->total.count;
+        if (batch->count < batch_reads) {
+            break;  // partial batch at the end only counts in the total
+        }
+        nbr_batches++;
+        result->batch_reads = batch_reads;
+        bool const converged = estimate_all(batches, nbr_batches, config, result);
+        if (callback != NULL) {
+            callback(result, arg);
+        }
+        if (converged) {
+            break;
+        }
+        if (nbr_batches == adaptive_nbr_batches) {
+            for (int i = 0; i < adaptive_nbr_batches / 2; i++) {
+                batches[i] = batches[2 * i];
+                histogram_merge(&batches[i], &batches[2 * i + 1]);
+            }
+            nbr_batches = adaptive_nbr_batches / 2;
+            batch_reads *= 2;
+        }
+        prev = clocktick_get_timevalue(&ctx);
+    }
+    if (!result->converged || result->nbr_batches != nbr_batches) {
+        estimate_all(batches, nbr_batches, config, result);
+    }
+    free(batches);
+    return clocktick_ok;
+}
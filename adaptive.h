@@ -0,0 +1,66 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+#include "histogram.h"
+
+// Adaptive test: runs the percentile test loop until the requested
+// percentiles are known precisely enough. The diffs go to a fixed number of
+// batch histograms. When all batches are full, neighbouring batches are merged
+// and the batch size doubles, so the batches get longer than the correlations
+// between the diffs. After each batch, a confidence interval is estimated for
+// every percentile with batch means: the percentiles of the batches give the
+// standard error of the percentile of all diffs. The test stops when every
+// interval is narrower than the tolerance, or when the duration is reached.
+//
+// The histogram buckets are 1.6% wide, so tolerances below that can stop the
+// test as soon as all batches fall in the same bucket.
+
+enum {
+    adaptive_max_percentiles = 16,
+    adaptive_nbr_batches = 32,
+    adaptive_min_batches = 10,
+    // A batch has at least this many diffs above the highest percentile
+    adaptive_min_tail_samples = 10
+};
+
+struct adaptive_config {
+    double const *percentiles;
+    int nbr_percentiles;
+    double tolerance;           // largest relative half width of the intervals, e.g. 0.05
+    int64_t duration_ns;        // longest run
+    uint64_t min_batch_reads;
+};
+
+// value +- half_width is the 95% confidence interval, in clock units
+struct adaptive_estimate {
+    double percentile;
+    int64_t value;
+    int64_t half_width;
+    double relative_width;
+};
+
+struct adaptive_result {
+    struct histogram total;
+    uint64_t nbr_reads;
+    int nbr_batches;
+    uint64_t batch_reads;
+    bool converged;
+    struct adaptive_estimate estimates[adaptive_max_percentiles];
+};
+
+typedef void (*adaptive_progress_callback)(struct adaptive_result const *, void *);
+
+double adaptive_t_quantile(int const);
+void adaptive_estimate(struct histogram const *, int const, struct histogram const *, double const, struct adaptive_estimate *);
+int clocktick_run_adaptive(struct clocktick_context const *, struct adaptive_config const *, struct adaptive_result *, adaptive_progress_callback, void *);
+
+#endif // ADAPTIVE_H
@@ -0,0 +1,498 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+// Benchmark for the analysis code of clocktick_jumps. The analyzers are run
+// on synthetic traces with a controlled distribution of clock jumps, or on a
+// recorded trace replayed through the mock clock, and the throughput and
+// memory of each analyzer are reported.
+//
+// Traces are generated in chunks, so that traces much larger than the memory
+// can be used. Analyzers that keep state (histogram, top-K) keep it over the
+// whole trace, the percentile sort and the cumulative windows work on one
+// chunk at a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/resource.h>
+#include "clocktick.h"
+#include "event_store.h"
+#include "histogram.h"
+#include "simd.h"
+
+enum { nbr_highest_values = 10 };
+
+struct bench_arguments {
+    double nbr_values;
+    uint64_t chunk_size;
+    char distribution;        // 'p' Pareto tail, 'b' periodic bursts, 'f' file
+    char const *trace_file;
+    double pareto_alpha;
+    int64_t base_ns;
+    uint64_t burst_period;    // values between the starts of bursts
+    uint64_t burst_length;    // values in a burst
+    int64_t burst_ns;
+    int64_t time_interval_ns;
+    uint64_t seed;
+};
+
+struct trace {
+    struct bench_arguments const *args;
+    uint64_t random_state;
+    uint64_t position;
+    int64_t now;
+    int64_t *recorded;        // diffs of a trace file
+    uint64_t nbr_recorded;
+};
+
+// One chunk of the trace: nbr_values + 1 timestamps give nbr_values diffs
+struct chunk {
+    int64_t *timestamps;
+    int64_t *diffs;
+    int64_t *scratch;
+    struct cumulative_test_results *events;
+    struct cumulative_test_results *replayed;
+    uint64_t nbr_values;
+    uint64_t nbr_events;
+    int64_t baseline;
+    int64_t time_interval_ns;
+};
+
+struct analyzer {
+    char const *name;
+    void (*run)(struct analyzer *, struct chunk *);
+    double seconds;
+    uint64_t values;          // values (or events) analyzed
+    uint64_t bytes;           // bytes of input read
+    uint64_t memory;          // largest working memory in bytes
+    int64_t result;           // printed, so that the work is not optimized away
+    struct histogram *histogram;
+    int64_t highest_values[nbr_highest_values];
+};
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// Uniform in (0, 1]
+static double next_uniform(uint64_t *state) {
+    return (double) ((next_random(state) >> 11) + 1) * 0x1p-53;
+}
+
+static int64_t next_diff(struct trace *t) {
+    struct bench_arguments const *args = t->args;
+    uint64_t const position = t->position++;
+    if (args->distribution == 'f') {
+        return t->recorded[position % t->nbr_recorded];
+    }
+    if (args->distribution == 'b') {
+        if (position % args->burst_period < args->burst_length) {
+            return args->burst_ns;
+        }
+        return args->base_ns + (int64_t) (next_random(&t->random_state) % 4);
+    }
+    double const d = (double) args->base_ns / pow(next_uniform(&t->random_state), 1.0 / args->pareto_alpha);
+    return (d < (double) one_billion) ? (int64_t) d : one_billion;
+}
+
+static void next_chunk(struct trace *t, struct chunk *c, uint64_t const nbr_values) {
+    c->nbr_values = nbr_values;
+    c->timestamps[0] = t->now;
+    for (uint64_t i = 0; i < nbr_values; i++) {
+        c->diffs[i] = next_diff(t);
+        c->timestamps[i + 1] = c->timestamps[i] + c->diffs[i];
+    }
+    t->now = c->timestamps[nbr_values];
+}
+
+// A trace file has one clock value (in ns) per line. Its diffs are repeated
+// to get as many values as needed.
+static int read_trace_file(struct trace *t, char const *name) {
+    FILE *f = fopen(name, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    uint64_t size = 1024;
+    t->recorded = malloc(size * sizeof(int64_t));
+    t->nbr_recorded = 0;
+    int64_t prev, next;
+    if (fscanf(f, "%" SCNd64, &prev) == 1) {
+        while (fscanf(f, "%" SCNd64, &next) == 1) {
+            if (t->nbr_recorded == size) {
+                size *= 2;
+                t->recorded = realloc(t->recorded, size * sizeof(int64_t));
+            }
+            t->recorded[t->nbr_recorded++] = next - prev;
+            prev = next;
+        }
+    }
+    fclose(f);
+    return (t->nbr_recorded > 0) ? 0 : -1;
+}
+
+//
+// Replay of a chunk through the mock clock
+//
+
+static struct {
+    int64_t const *timestamps;
+    uint64_t nbr_timestamps;
+    uint64_t next;
+    int64_t offset;
+    uint64_t reads;
+} replay;
+
+static void replay_chunk(struct chunk const *c) {
+    replay.timestamps = c->timestamps;
+    replay.nbr_timestamps = c->nbr_values + 1;
+    replay.next = 0;
+    replay.offset = 0;
+    replay.reads = 0;
+}
+
+// Wraps around to the start of the chunk, so the clock never goes backwards
+static int64_t replay_get_timevalue(bool const restart) {
+    if (restart) {
+        replay.next = 0;
+        replay.offset = 0;
+        return 0;
+    }
+    replay.reads++;
+    int64_t const v = replay.timestamps[replay.next++] + replay.offset;
+    if (replay.next == replay.nbr_timestamps) {
+        replay.offset += replay.timestamps[replay.nbr_timestamps - 1] - replay.timestamps[0];
+        replay.next = 1;
+    }
+    return v;
+}
+
+static struct clocktick_context replay_context(void) {
+    struct clocktick_context ctx;
+    clocktick_init(&ctx, 'm');
+    ctx.mock_clock = &replay_get_timevalue;
+    clocktick_calibrate(&ctx);
+    return ctx;
+}
+
+//
+// Analyzers
+//
+
+static int int_comparison(const void *i, const void *j) {
+    return (*(int64_t const*) i < *(int64_t const*) j) ? -1:1;
+}
+
+static void update_memory(struct analyzer *a, uint64_t const bytes) {
+    if (bytes > a->memory) {
+        a->memory = bytes;
+    }
+}
+
+// Same as report_percentiles in clocktick_jumps.c
+static void run_sort(struct analyzer *a, struct chunk *c) {
+    memcpy(c->scratch, c->diffs, c->nbr_values * sizeof(int64_t));
+    qsort(c->scratch, c->nbr_values, sizeof(int64_t), &int_comparison);
+    a->result = c->scratch[(uint64_t) ((double) c->nbr_values * 0.999)];
+    a->values += c->nbr_values;
+    a->bytes += c->nbr_values * sizeof(int64_t);
+    update_memory(a, c->nbr_values * sizeof(int64_t));
+}
+
+static void run_histogram(struct analyzer *a, struct chunk *c) {
+    histogram_add_values(a->histogram, c->diffs, c->nbr_values);
+    a->result = a->histogram->max;
+    a->values += c->nbr_values;
+    a->bytes += c->nbr_values * sizeof(int64_t);
+    update_memory(a, sizeof(struct histogram));
+}
+
+static void run_filter(struct analyzer *a, struct chunk *c) {
+    uint64_t const n = simd_filter_above(c->diffs, c->nbr_values, c->baseline, c->scratch);
+    a->result += (int64_t) n;
+    a->values += c->nbr_values;
+    a->bytes += c->nbr_values * sizeof(int64_t);
+    update_memory(a, n * sizeof(int64_t));
+}
+
+static void run_topk(struct analyzer *a, struct chunk *c) {
+    find_highest_values(c->events, c->nbr_events, a->highest_values, nbr_highest_values);
+    a->result = a->highest_values[nbr_highest_values - 1];
+    a->values += c->nbr_events;
+    a->bytes += c->nbr_events * sizeof(struct cumulative_test_results);
+    update_memory(a, sizeof(a->highest_values));
+}
+
+static void run_cumulative(struct analyzer *a, struct chunk *c) {
+    if (c->nbr_events > 0) {
+        find_highest_cumulative_values(c->events, c->nbr_events, a->highest_values, nbr_highest_values, c->time_interval_ns);
+    }
+    a->result = a->highest_values[nbr_highest_values - 1];
+    a->values += c->nbr_events;
+    a->bytes += c->nbr_events * sizeof(struct cumulative_test_results);
+    update_memory(a, sizeof(a->highest_values));
+}
+
+static void run_event_store(struct analyzer *a, struct chunk *c) {
+    // Room for the longest encoding, so that all events fit
+    struct event_store store;
+    if (event_store_init(&store, c->nbr_events * 20) < 0) {
+        printf("Allocating event store failed, exiting\n");
+        exit(-1);
+    }
+    for (uint64_t i = 0; i < c->nbr_events; i++) {
+        if (!event_store_append(&store, c->events[i].timestamp, c->events[i].diff)) {
+            break;
+        }
+    }
+    find_highest_values_in_event_store(&store, a->highest_values, nbr_highest_values);
+    a->result = a->highest_values[nbr_highest_values - 1];
+    a->values += store.nbr_events;
+    a->bytes += store.nbr_events * sizeof(struct cumulative_test_results);
+    update_memory(a, event_store_bytes_allocated(&store));
+    event_store_free(&store);
+}
+
+// The measurement loop of the percentile test reading the chunk through the
+// mock clock
+static void run_replay_percentile(struct analyzer *a, struct chunk *c) {
+    struct clocktick_context const ctx = replay_context();
+    replay_chunk(c);
+    clocktick_run_percentile_test(&ctx, c->scratch, c->nbr_values);
+    a->result = c->scratch[c->nbr_values - 1];
+    a->values += replay.reads;
+    a->bytes += c->nbr_values * sizeof(int64_t);
+    update_memory(a, c->nbr_values * sizeof(int64_t));
+}
+
+static void run_replay_streaming(struct analyzer *a, struct chunk *c) {
+    struct clocktick_context const ctx = replay_context();
+    replay_chunk(c);
+    clocktick_run_percentile_test_streaming(&ctx, c->scratch, c->nbr_values);
+    a->result = c->scratch[c->nbr_values - 1];
+    a->values += replay.reads;
+    a->bytes += c->nbr_values * sizeof(int64_t);
+    update_memory(a, c->nbr_values * sizeof(int64_t));
+}
+
+static void run_replay_cumulative(struct analyzer *a, struct chunk *c) {
+    struct clocktick_context const ctx = replay_context();
+    replay_chunk(c);
+    clocktick_run_cumulative_test_with_baseline(&ctx, c->nbr_events, c->baseline, c->replayed);
+    a->result = c->replayed[c->nbr_events - 1].diff;
+    a->values += replay.reads;
+    a->bytes += c->nbr_events * sizeof(struct cumulative_test_results);
+    update_memory(a, c->nbr_events * sizeof(struct cumulative_test_results));
+}
+
+// Baseline estimation, which reads the clock one million times
+static void run_baseline(struct analyzer *a, struct chunk *c) {
+    struct clocktick_context const ctx = replay_context();
+    replay_chunk(c);
+    clocktick_get_baseline_time(&ctx, &a->result);
+    a->values += replay.reads;
+    a->bytes += replay.reads * sizeof(int64_t);
+    update_memory(a, 0);
+}
+
+// Converts the timestamps of the events in place, so it must be run last
+static void run_to_ns(struct analyzer *a, struct chunk *c) {
+    simd_timestamps_to_ns(c->events, c->nbr_events, 0.37);
+    a->result = c->events[c->nbr_events - 1].timestamp;
+    a->values += c->nbr_events;
+    a->bytes += c->nbr_events * sizeof(struct cumulative_test_results);
+    update_memory(a, 0);
+}
+
+// Events over the baseline, as stored by the cumulative test
+static void find_events(struct chunk *c) {
+    c->events[0].timestamp = c->timestamps[0];
+    c->events[0].diff = 0;
+    uint64_t k = 1;
+    for (uint64_t i = 0; i < c->nbr_values; i++) {
+        if (c->diffs[i] > c->baseline) {
+            c->events[k].timestamp = c->timestamps[i];
+            c->events[k].diff = c->diffs[i] - c->baseline;
+            k++;
+        }
+    }
+    c->nbr_events = k;
+}
+
+static double seconds_since(struct timespec const *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / (double) one_billion;
+}
+
+static void print_usage(void) {
+    printf("Usage: \n"
+        "-n values: number of clock values in the trace, e.g. 1e9 \n    default is 1e7 \n"
+        "-c values: number of values analyzed at a time \n    default is 4194304 \n"
+        "-d distribution: pareto (Pareto tail) or burst (periodic bursts) \n    default is pareto \n"
+        "-f file: replay the clock values in file (one value in ns per line) instead \n"
+        "-a alpha: shape of the Pareto tail \n    default is 1.5 \n"
+        "-b ns: smallest diff of the trace \n    default is 20 \n"
+        "-t time_interval: interval (in ns) for the cumulative values \n    default is 1000000 \n"
+        "-s seed: seed for the synthetic traces \n    default is 1 \n");
+}
+
+static void parse_bench_arguments(int argc, char **argv, struct bench_arguments *args) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:d:f:a:b:t:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            args->nbr_values = strtod(optarg, NULL);
+            break;
+        case 'c':
+            args->chunk_size = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            if (strcmp(optarg, "pareto") == 0) {
+                args->distribution = 'p';
+            } else if (strcmp(optarg, "burst") == 0) {
+                args->distribution = 'b';
+            } else {
+                printf("Unknown distribution %s, exiting\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'f':
+            args->distribution = 'f';
+            args->trace_file = optarg;
+            break;
+        case 'a':
+            args->pareto_alpha = strtod(optarg, NULL);
+            break;
+        case 'b':
+            args->base_ns = strtoll(optarg, NULL, 0);
+            break;
+        case 't':
+            args->time_interval_ns = strtoll(optarg, NULL, 0);
+            break;
+        case 's':
+            args->seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            print_usage();
+            exit(-1);
+        }
+    }
+    if (args->nbr_values < 1 || args->chunk_size < 2 || args->pareto_alpha <= 0 || args->base_ns <= 0 || args->time_interval_ns <= 0) {
+        print_usage();
+        exit(-1);
+    }
+}
+
+int main(int argc, char **argv) {
+    struct bench_arguments args = {
+        .nbr_values = 1e7,
+        .chunk_size = 4194304,
+        .distribution = 'p',
+        .pareto_alpha = 1.5,
+        .base_ns = 20,
+        .burst_period = 100000,
+        .burst_length = 100,
+        .burst_ns = 10000,
+        .time_interval_ns = one_million,
+        .seed = 1
+    };
+    parse_bench_arguments(argc, argv, &args);
+    uint64_t const nbr_values = (uint64_t) args.nbr_values;
+
+    struct trace trace = {.args = &args, .random_state = args.seed | 1, .now = one_billion};
+    if (args.distribution == 'f') {
+        if (read_trace_file(&trace, args.trace_file) < 0) {
+            printf("Reading trace file %s failed, exiting\n", args.trace_file);
+            exit(-1);
+        }
+        printf("Replaying %" PRIu64 " clock values from %s\n", trace.nbr_recorded + 1, args.trace_file);
+    } else if (args.distribution == 'b') {
+        printf("Periodic bursts of %" PRIu64 " values of %" PRId64 " ns every %" PRIu64 " values\n", \
+            args.burst_length, args.burst_ns, args.burst_period);
+    } else {
+        printf("Pareto distribution with minimum %" PRId64 " ns and alpha %g\n", args.base_ns, args.pareto_alpha);
+    }
+    printf("Analyzing %" PRIu64 " values in chunks of %" PRIu64 " values with %s post-processing\n\n", \
+        nbr_values, args.chunk_size, simd_level_name(simd_get_level()));
+
+    uint64_t const chunk_size = (args.chunk_size < nbr_values) ? args.chunk_size : nbr_values;
+    struct chunk c = {.time_interval_ns = args.time_interval_ns};
+    c.timestamps = malloc((chunk_size + 1) * sizeof(int64_t));
+    c.diffs = malloc(chunk_size * sizeof(int64_t));
+    c.scratch = malloc(chunk_size * sizeof(int64_t));
+    c.events = malloc((chunk_size + 1) * sizeof(struct cumulative_test_results));
+    c.replayed = malloc((chunk_size + 1) * sizeof(struct cumulative_test_results));
+    if (c.timestamps == NULL || c.diffs == NULL || c.scratch == NULL || c.events == NULL || c.replayed == NULL) {
+        printf("Allocating %" PRIu64 " values failed, exiting\n", chunk_size);
+        exit(-1);
+    }
+
+    struct analyzer analyzers[] = {
+        {.name = "baseline", .run = &run_baseline},
+        {.name = "sort", .run = &run_sort},
+        {.name = "histogram", .run = &run_histogram},
+        {.name = "filter", .run = &run_filter},
+        {.name = "topk", .run = &run_topk},
+        {.name = "cumulative", .run = &run_cumulative},
+        {.name = "event_store", .run = &run_event_store},
+        {.name = "replay_percentile", .run = &run_replay_percentile},
+        {.name = "replay_streaming", .run = &run_replay_streaming},
+        {.name = "replay_cumulative", .run = &run_replay_cumulative},
+        {.name = "to_ns", .run = &run_to_ns},
+    };
+    int const nbr_analyzers = sizeof(analyzers) / sizeof(analyzers[0]);
+    struct histogram *h = malloc(sizeof(struct histogram));
+    histogram_init(h);
+    analyzers[2].histogram = h;
+
+    struct timespec start;
+    double generate_seconds = 0;
+    for (uint64_t done = 0; done < nbr_values; done += c.nbr_values) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        next_chunk(&trace, &c, (nbr_values - done < chunk_size) ? nbr_values - done : chunk_size);
+        if (done == 0) {
+            // Twice the average, as in the cumulative test
+            struct clocktick_context const ctx = replay_context();
+            replay_chunk(&c);
+            clocktick_get_baseline_time(&ctx, &c.baseline);
+            c.baseline *= 2;
+        }
+        find_events(&c);
+        generate_seconds += seconds_since(&start);
+        for (int i = 0; i < nbr_analyzers; i++) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            analyzers[i].run(&analyzers[i], &c);
+            analyzers[i].seconds += seconds_since(&start);
+        }
+    }
+
+    printf("%-18s %14s %10s %10s %10s %12s %14s\n", "analyzer", "values", "seconds", "Mvalues/s", "MB/s", "memory kB", "result");
+    for (int i = 0; i < nbr_analyzers; i++) {
+        struct analyzer const *a = &analyzers[i];
+        double const seconds = (a->seconds > 0) ? a->seconds : 1e-9;
+        printf("%-18s %14" PRIu64 " %10.3f %10.1f %10.1f %12" PRIu64 " %14" PRId64 "\n", a->name, a->values, a->seconds, \
+            (double) a->values / seconds / 1e6, (double) a->bytes / seconds / 1e6, a->memory / 1024, a->result);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("\nBaseline was %" PRId64 " ns, %" PRIu64 " events over it in the last chunk\n", c.baseline, c.nbr_events);
+    printf("Generating the trace took %.3f s, peak resident memory was %ld kB\n", generate_seconds, usage.ru_maxrss);
+
+    free(h);
+    free(c.timestamps);
+    free(c.diffs);
+    free(c.scratch);
+    free(c.events);
+    free(c.replayed);
+    free(trace.recorded);
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <sys/stat.h>
+#include "calibration_cache.h"
+
+// Largest relative difference between the cached multiplier and the check
+static double const calibration_check_tolerance = 0.001;
+// The same for the baseline. Twice the baseline is the threshold of the
+// cumulative test, so a cached baseline has to be close to the check.
+static double const calibration_baseline_tolerance = 0.1;
+
+// Reads the first line of a file without the newline, "" on errors
+static void read_line(char const *path, char *line, size_t const size) {
+    line[0] = '\0';
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    if (fgets(line, (int) size, f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+    }
+    fclose(f);
+}
+
+// Copies as much of src as fits
+static void copy_value(char *dst, size_t const size, char const *src) {
+    size_t n = strlen(src);
+    if (n >= size) {
+        n = size - 1;
+    }
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+static void read_cpu_model(char *model, size_t const size) {
+    model[0] = '\0';
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "model name", 10) == 0 && strchr(line, ':') != NULL) {
+            char const *value = strchr(line, ':') + 1;
+            value += strspn(value, " \t");
+            copy_value(model, size, value);
+            model[strcspn(model, "\n")] = '\0';
+            break;
+        }
+    }
+    fclose(f);
+}
+
+// TSC frequency from cpuid leaf 0x15, or the base frequency from leaf 0x16
+static uint64_t read_tsc_hz(void) {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int const max_leaf = __get_cpuid_max(0, NULL);
+    if (max_leaf >= 0x15) {
+        __cpuid_count(0x15, 0, eax, ebx, ecx, edx);
+        if (eax != 0 && ebx != 0 && ecx != 0) {
+            return (uint64_t) ecx * ebx / eax;
+        }
+    }
+    if (max_leaf >= 0x16) {
+        __cpuid_count(0x16, 0, eax, ebx, ecx, edx);
+        return (uint64_t) (eax & 0xffff) * one_million;
+    }
+    return 0;
+}
+
+int calibration_get_key(struct calibration_key *key) {
+    memset(key, 0, sizeof(*key));
+    read_line("/proc/sys/kernel/random/boot_id", key->boot_id, sizeof(key->boot_id));
+    read_line("/sys/devices/system/clocksource/clocksource0/current_clocksource", key->clocksource, sizeof(key->clocksource));
+    read_cpu_model(key->cpu_model, sizeof(key->cpu_model));
+    key->tsc_hz = read_tsc_hz();
+    // Without a boot id a reboot could not be noticed
+    return (key->boot_id[0] == '\0') ? clocktick_error_system : clocktick_ok;
+}
+
+static bool same_key(struct calibration_key const *a, struct calibration_key const *b) {
+    return strcmp(a->boot_id, b->boot_id) == 0 && strcmp(a->cpu_model, b->cpu_model) == 0 && \
+        a->tsc_hz == b->tsc_hz && strcmp(a->clocksource, b->clocksource) == 0;
+}
+
+// $XDG_CACHE_HOME/clocktick_calibration or ~/.cache/clocktick_calibration,
+// NULL if neither is set
+char const *calibration_cache_default_path(void) {
+    static char path[4096];
+    char const *dir = getenv("XDG_CACHE_HOME");
+    if (dir != NULL && dir[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/clocktick_calibration", dir);
+        return path;
+    }
+    dir = getenv("HOME");
+    if (dir == NULL || dir[0] == '\0') {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/.cache/clocktick_calibration", dir);
+    return path;
+}
+
+// The cache always gets the key of the running system. The entries of the
+// file are used only if the file has the same key. Returns
+// clocktick_error_system if the key can not be read, or if the file is
+// missing or has another key.
+int calibration_cache_load(struct calibration_cache *cache, char const *path) {
+    memset(cache, 0, sizeof(*cache));
+    int status = calibration_get_key(&cache->key);
+    if (status < 0) {
+        return status;
+    }
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return clocktick_error_system;
+    }
+    struct calibration_key file_key;
+    memset(&file_key, 0, sizeof(file_key));
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        struct calibration_entry e;
+        if (strncmp(line, "boot_id ", 8) == 0) {
+            copy_value(file_key.boot_id, sizeof(file_key.boot_id), line + 8);
+        } else if (strncmp(line, "cpu_model ", 10) == 0) {
+            copy_value(file_key.cpu_model, sizeof(file_key.cpu_model), line + 10);
+        } else if (strncmp(line, "clocksource ", 12) == 0) {
+            copy_value(file_key.clocksource, sizeof(file_key.clocksource), line + 12);
+        } else if (sscanf(line, "tsc_hz %" SCNu64, &file_key.tsc_hz) == 1) {
+            continue;
+        } else if (sscanf(line, "multiplier %c %d %lf", &e.clocktype, &e.cpu, &e.value) == 3) {
+            calibration_cache_set(cache, 'm', e.clocktype, e.cpu, e.value);
+        } else if (sscanf(line, "baseline %c %d %lf", &e.clocktype, &e.cpu, &e.value) == 3) {
+            calibration_cache_set(cache, 'b', e.clocktype, e.cpu, e.value);
+        }
+    }
+    fclose(f);
+    cache->changed = false;
+    if (!same_key(&cache->key, &file_key)) {
+        cache->nbr_entries = 0;
+        return clocktick_error_system;
+    }
+    return clocktick_ok;
+}
+
+// Writes a new file and renames it over the old one, so that runs started at
+// the same time never see a partial file. Does nothing if nothing changed.
+int calibration_cache_save(struct calibration_cache *cache, char const *path) {
+    if (!cache->changed) {
+        return clocktick_ok;
+    }
+    // The directory is created only when there is something to save, e.g.
+    // ~/.cache on a new system
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s", path);
+    char *slash = strrchr(tmp_path, '/');
+    if (slash != NULL && slash != tmp_path) {
+        *slash = '\0';
+        mkdir(tmp_path, 0755);
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int) getpid());
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        return clocktick_error_system;
+    }
+    fprintf(f, "boot_id %s\ncpu_model %s\ntsc_hz %" PRIu64 "\nclocksource %s\n", \
+        cache->key.boot_id, cache->key.cpu_model, cache->key.tsc_hz, cache->key.clocksource);
+    for (int i = 0; i < cache->nbr_entries; i++) {
+        struct calibration_entry const *e = &cache->entries[i];
+        fprintf(f, "%s %c %d %.17g\n", (e->kind == 'm') ? "multiplier" : "baseline", e->clocktype, e->cpu, e->value);
+    }
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return clocktick_error_system;
+    }
+    cache->changed = false;
+    return clocktick_ok;
+}
+
+bool calibration_cache_find(struct calibration_cache const *cache, char const kind, char const clocktype, int const cpu, double *value) {
+    for (int i = 0; i < cache->nbr_entries; i++) {
+        struct calibration_entry const *e = &cache->entries[i];
+        if (e->kind == kind && e->clocktype == clocktype && e->cpu == cpu) {
+            *value = e->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// When the cache is full, the oldest entry is replaced
+void calibration_cache_set(struct calibration_cache *cache, char const kind, char const clocktype, int const cpu, double const value) {
+    cache->changed = true;
+    for (int i = 0; i < cache->nbr_entries; i++) {
+        struct calibration_entry *e = &cache->entries[i];
+        if (e->kind == kind && e->clocktype == clocktype && e->cpu == cpu) {
+            e->value = value;
+            return;
+        }
+    }
+    if (cache->nbr_entries == calibration_cache_max_entries) {
+        memmove(&cache->entries[0], &cache->entries[1], (calibration_cache_max_entries - 1) * sizeof(struct calibration_entry));
+        cache->nbr_entries--;
+    }
+    struct calibration_entry const e = {.kind = kind, .clocktype = clocktype, .cpu = cpu, .value = value};
+    cache->entries[cache->nbr_entries++] = e;
+}
+
+// Like clocktick_calibrate, but uses the cached multiplier if a measurement
+// of calibration_check_ns agrees with it. cached tells if it was used.
+int clocktick_calibrate_cached(struct clocktick_context *ctx, struct calibration_cache *cache, bool *cached) {
+    *cached = false;
+    if (clocktick_units_in_ns(ctx)) {
+        return clocktick_calibrate(ctx);
+    }
+    double multiplier;
+    if (calibration_cache_find(cache, 'm', ctx->clocktype, -1, &multiplier)) {
+        double check;
+        int status = clocktick_measure_multiplier(ctx, calibration_check_ns, &check);
+        if (status < 0) {
+            return status;
+        }
+        double const difference = (check > multiplier) ? check - multiplier : multiplier - check;
+        if (difference <= calibration_check_tolerance * multiplier) {
+            ctx->cyc2ns_multiplier = multiplier;
+            ctx->cyc2ns_multiplier_initialized = true;
+            *cached = true;
+            return clocktick_ok;
+        }
+    }
+    int status = clocktick_calibrate(ctx);
+    if (status < 0) {
+        return status;
+    }
+    calibration_cache_set(cache, 'm', ctx->clocktype, -1, ctx->cyc2ns_multiplier);
+    return clocktick_ok;
+}
+
+// Like clocktick_get_baseline_time on CPU cpu, but uses the cached baseline if
+// the average of calibration_check_reads reads is within
+// calibration_baseline_tolerance of it
+int clocktick_get_baseline_time_cached(struct clocktick_context const *ctx, struct calibration_cache *cache, int const cpu, int64_t *baseline, bool *cached) {
+    *cached = false;
+    double cached_baseline;
+    if (calibration_cache_find(cache, 'b', ctx->clocktype, cpu, &cached_baseline)) {
+        int64_t check;
+        int status = clocktick_get_average_diff(ctx, calibration_check_reads, &check);
+        if (status < 0) {
+            return status;
+        }
+        if (fabs((double) check - cached_baseline) <= calibration_baseline_tolerance * cached_baseline) {
+            *baseline = (int64_t) cached_baseline;
+            *cached = true;
+            return clocktick_ok;
+        }
+    }
+    int status = clocktick_get_baseline_time(ctx, baseline);
+    if (status < 0) {
+        return status;
+    }
+    calibration_cache_set(cache, 'b', ctx->clocktype, cpu, (double) *baseline);
+    return clocktick_ok;
+}
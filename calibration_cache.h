@@ -0,0 +1,58 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef CALIBRATION_CACHE_H
+#define CALIBRATION_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Cache of calibration results in a file, so that short runs do not have to
+// sleep a second for the cycles to ns multiplier and read the clock a million
+// times for the baseline. The cache is valid only on the same boot, CPU model,
+// TSC frequency and clocksource. Cached values are checked with a short
+// measurement before they are used, and measured again if the check fails.
+
+enum {
+    calibration_cache_max_entries = 256,
+    calibration_check_ns = 10 * one_million,    // for the multiplier
+    calibration_check_reads = 10000             // for the baseline
+};
+
+struct calibration_key {
+    char boot_id[64];
+    char cpu_model[128];
+    uint64_t tsc_hz;            // from cpuid, 0 if the CPU does not tell
+    char clocksource[32];
+};
+
+// kind is 'm' for the multiplier and 'b' for the baseline (average diff in
+// clock units). cpu is -1 for the multiplier, which is the same for all CPUs.
+struct calibration_entry {
+    char kind;
+    char clocktype;
+    int cpu;
+    double value;
+};
+
+struct calibration_cache {
+    struct calibration_key key;
+    struct calibration_entry entries[calibration_cache_max_entries];
+    int nbr_entries;
+    bool changed;
+};
+
+int calibration_get_key(struct calibration_key *);
+char const *calibration_cache_default_path(void);
+int calibration_cache_load(struct calibration_cache *, char const *);
+int calibration_cache_save(struct calibration_cache *, char const *);
+bool calibration_cache_find(struct calibration_cache const *, char const, char const, int const, double *);
+void calibration_cache_set(struct calibration_cache *, char const, char const, int const, double const);
+int clocktick_calibrate_cached(struct clocktick_context *, struct calibration_cache *, bool *);
+int clocktick_get_baseline_time_cached(struct clocktick_context const *, struct calibration_cache *, int const, int64_t *, bool *);
+
+#endif // CALIBRATION_CACHE_H
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+// Merges the result summaries saved by cj -o, e.g. from all hosts of a fleet,
+// and reports the percentiles and the largest values of each group of
+// summaries. Groups are given by label keys, e.g. -g cpu_model,hypervisor
+// gives one group for each combination of CPU model and hypervisor. Summaries
+// of different tests are never merged, so the test label is always the first
+// key. The files are loaded and merged by several threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "clocktick.h"
+#include "result_summary.h"
+
+enum {
+    max_group_keys = 8,
+    group_name_length = 512,
+    nbr_reported_top = 10
+};
+
+static double const percentiles[] = {0.50, 0.9, 0.99, 0.999, 0.9999, 0.99999, 0.999999};
+
+struct group {
+    char name[group_name_length];
+    uint64_t nbr_files;
+    struct result_summary *summary;
+};
+
+struct group_table {
+    struct group *groups;
+    int nbr_groups;
+    int capacity;
+};
+
+struct merge_job {
+    char **files;
+    uint64_t nbr_files;
+    uint64_t next_file;         // shared by the workers
+    char const *keys[max_group_keys];
+    int nbr_keys;
+};
+
+struct worker {
+    pthread_t thread;
+    struct merge_job *job;
+    struct group_table table;
+    uint64_t nbr_failed;
+};
+
+static void group_name(struct merge_job const *job, struct result_summary const *s, char *name) {
+    int n = 0;
+    name[0] = '\0';
+    for (int i = 0; i < job->nbr_keys; i++) {
+        char const *value = result_summary_get_label(s, job->keys[i]);
+        n += snprintf(name + n, group_name_length - n, "%s%s=%s", (i > 0) ? ", " : "", job->keys[i], value ? value : "-");
+        if (n >= group_name_length) {
+            break;
+        }
+    }
+}
+
+// Merges s into its group, or copies it to a new group. Groups have the same
+// test label, so merging fails only for summaries without one.
+static int add_to_table(struct group_table *table, char const *name, struct result_summary const *s, uint64_t const nbr_files) {
+    for (int i = 0; i < table->nbr_groups; i++) {
+        if (strcmp(table->groups[i].name, name) == 0) {
+            int const status = result_summary_merge(table->groups[i].summary, s);
+            if (status == clocktick_ok) {
+                table->groups[i].nbr_files += nbr_files;
+            }
+            return status;
+        }
+    }
+    if (table->nbr_groups == table->capacity) {
+        table->capacity = table->capacity ? 2 * table->capacity : 16;
+        table->groups = realloc(table->groups, table->capacity * sizeof(struct group));
+        if (table->groups == NULL) {
+            printf("Out of memory, exiting\n");
+            exit(-1);
+        }
+    }
+    struct group *g = &table->groups[table->nbr_groups++];
+    snprintf(g->name, sizeof(g->name), "%s", name);
+    g->nbr_files = nbr_files;
+    g->summary = malloc(sizeof(struct result_summary));
+    if (g->summary == NULL) {
+        printf("Out of memory, exiting\n");
+        exit(-1);
+    }
+    *g->summary = *s;
+    return clocktick_ok;
+}
+
+static void *merge_files(void *arg) {
+    struct worker *w = arg;
+    struct merge_job *job = w->job;
+    struct result_summary *s = malloc(sizeof(struct result_summary));
+    char name[group_name_length];
+    for (;;) {
+        uint64_t const i = __atomic_fetch_add(&job->next_file, 1, __ATOMIC_RELAXED);
+        if (i >= job->nbr_files) {
+            break;
+        }
+        int const status = result_summary_load(s, job->files[i]);
+        if (status < 0) {
+            fprintf(stderr, "Skipping %s: %s\n", job->files[i], \
+                (status == clocktick_error_system) ? "can not be read" : "not a valid summary");
+            w->nbr_failed++;
+            continue;
+        }
+        group_name(job, s, name);
+        if (add_to_table(&w->table, name, s, 1) < 0) {
+            fprintf(stderr, "Skipping %s: no test label\n", job->files[i]);
+            w->nbr_failed++;
+        }
+    }
+    free(s);
+    return NULL;
+}
+
+static int group_comparison(const void *a, const void *b) {
+    return strcmp(((struct group const *) a)->name, ((struct group const *) b)->name);
+}
+
+static void print_group(struct group const *g) {
+    struct result_summary const *s = g->summary;
+    printf("\n%s: %" PRIu64 " files, %" PRIu64 " values\n", g->name, g->nbr_files, s->histogram.count);
+    for (int i = 0; i < s->nbr_labels; i++) {
+        if (strcmp(s->labels[i].value, "*") != 0) {
+            printf("    %s %s\n", s->labels[i].key, s->labels[i].value);
+        }
+    }
+    if (s->histogram.count > 0) {
+        printf("Percentiles are:\n");
+        for (unsigned int i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+            printf("%f : %10" PRId64 " ns\n", percentiles[i], result_summary_percentile(s, percentiles[i]));
+        }
+        printf("max      : %10" PRId64 " ns\n", s->histogram.max);
+    }
+    int const n = (s->nbr_top < nbr_reported_top) ? s->nbr_top : nbr_reported_top;
+    printf("Largest %d values are:\n", n);
+    for (int i = 0; i < n; i++) {
+        printf("%10" PRId64 " ns\n", s->top[i]);
+    }
+}
+
+static void print_usage(void) {
+    printf("Usage: cj_merge [-g keys] [-j threads] [-l list] [files]\n"
+        "-g keys: comma separated label keys to group by, e.g. cpu_model,hypervisor \n    the test label is always the first key \n"
+        "-j threads: number of threads loading the files \n    default is the number of online CPUs \n"
+        "-l list: file with the names of more summary files, one per line \n");
+}
+
+// Adds the lines of list to files
+static void read_list(char const *list, char ***files, uint64_t *nbr_files) {
+    FILE *f = fopen(list, "r");
+    if (f == NULL) {
+        printf("Can not open %s, exiting\n", list);
+        exit(-1);
+    }
+    char line[4096];
+    uint64_t capacity = *nbr_files;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (*nbr_files == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            *files = realloc(*files, capacity * sizeof(char *));
+        }
+        (*files)[(*nbr_files)++] = strdup(line);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    struct merge_job job = {0};
+    long nbr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char *keys = NULL;
+    char const *list = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "g:j:l:")) != -1) {
+        switch (opt) {
+        case 'g':
+            keys = strdup(optarg);
+            break;
+        case 'j':
+            nbr_threads = strtol(optarg, NULL, 0);
+            break;
+        case 'l':
+            list = optarg;
+            break;
+        default:
+            print_usage();
+            exit(-1);
+        }
+    }
+    job.keys[job.nbr_keys++] = "test";
+    for (char *key = keys ? strtok(keys, ",") : NULL; key != NULL; key = strtok(NULL, ",")) {
+        if (strcmp(key, "test") == 0) {
+            continue;
+        }
+        if (job.nbr_keys == max_group_keys) {
+            printf("At most %d group keys, exiting\n", max_group_keys);
+            exit(-1);
+        }
+        job.keys[job.nbr_keys++] = key;
+    }
+    job.nbr_files = argc - optind;
+    job.files = malloc((job.nbr_files + 1) * sizeof(char *));
+    memcpy(job.files, argv + optind, job.nbr_files * sizeof(char *));
+    if (list != NULL) {
+        read_list(list, &job.files, &job.nbr_files);
+    }
+    if (job.nbr_files == 0 || nbr_threads < 1) {
+        print_usage();
+        exit(-1);
+    }
+    if ((uint64_t) nbr_threads > job.nbr_files) {
+        nbr_threads = (long) job.nbr_files;
+    }
+
+    struct worker *workers = calloc(nbr_threads, sizeof(struct worker));
+    for (long i = 0; i < nbr_threads; i++) {
+        workers[i].job = &job;
+        if (pthread_create(&workers[i].thread, NULL, &merge_files, &workers[i]) != 0) {
+            printf("Starting a thread failed, exiting\n");
+            exit(-1);
+        }
+    }
+    struct group_table total = {0};
+    uint64_t nbr_failed = 0;
+    for (long i = 0; i < nbr_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        for (int j = 0; j < workers[i].table.nbr_groups; j++) {
+            struct group *g = &workers[i].table.groups[j];
+            if (add_to_table(&total, g->name, g->summary, g->nbr_files) < 0) {
+                printf("Merging group %s failed, exiting\n", g->name);
+                exit(-1);
+            }
+            free(g->summary);
+        }
+        free(workers[i].table.groups);
+        nbr_failed += workers[i].nbr_failed;
+    }
+
+    qsort(total.groups, total.nbr_groups, sizeof(struct group), &group_comparison);
+    printf("Merged %" PRIu64 " files into %d groups, skipped %" PRIu64 " files\n", \
+        job.nbr_files - nbr_failed, total.nbr_groups, nbr_failed);
+    for (int i = 0; i < total.nbr_groups; i++) {
+        print_group(&total.groups[i]);
+        free(total.groups[i].summary);
+    }
+    free(total.groups);
+    free(workers);
+    return (nbr_failed > 0) ? 1 : 0;
+}
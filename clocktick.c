@@ -0,0 +1,423 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+#include "clocktick.h"
+#include "event_store.h"
+#include "simd.h"
+
+char const *clocktick_strerror(int const status) {
+    switch (status) {
+    case clocktick_ok:
+        return "no error";
+    case clocktick_error_clocktype:
+        return "invalid clock type";
+    case clocktick_error_not_calibrated:
+        return "cycles to ns calculation not initialized";
+    case clocktick_error_baseline:
+        return "calculating baseline failed";
+    case clocktick_error_argument:
+        return "invalid argument";
+    case clocktick_error_system:
+        return "system call failed";
+    default:
+        return "unknown error";
+    }
+}
+
+int64_t s2ns(int64_t const secs) {
+    return one_billion * secs;
+}
+
+int64_t ns2s(int64_t const ns) {
+    return (int64_t) ((double) ns/ (double) one_billion);
+}
+
+enum {
+    streaming_line_bytes = 64,
+    streaming_line_values = streaming_line_bytes / sizeof(int64_t)
+};
+
+static int int_comparison(const void *i, const void *j) {
+    return (*(int64_t const*) i < *(int64_t const*) j) ? -1:1;
+}
+
+// Mock clock must be set separately after clocktick_init
+int clocktick_init(struct clocktick_context *ctx, char const clocktype) {
+    memset(ctx, 0, sizeof(*ctx));
+    if (clocktype != 'r' && clocktype != 't' && clocktype != 'p' && clocktype != 'm') {
+        return clocktick_error_clocktype;
+    }
+    ctx->clocktype = clocktype;
+    return clocktick_ok;
+}
+
+// Clock types that can be read, the mock clock only with a mock_clock
+int clocktick_check_clock(struct clocktick_context const *ctx) {
+    if (ctx->clocktype == 'r' || ctx->clocktype == 't' || ctx->clocktype == 'p') {
+        return clocktick_ok;
+    }
+    if (ctx->clocktype == 'm' && ctx->mock_clock != NULL) {
+        return clocktick_ok;
+    }
+    return clocktick_error_clocktype;
+}
+
+bool clocktick_units_in_ns(struct clocktick_context const *ctx) {
+    return ctx->clocktype == 'r' || ctx->clocktype == 'm';
+}
+
+// Measure one cyc in ns against CLOCK_REALTIME over sleep_ns. Longer sleeps
+// give more precise results.
+int clocktick_measure_multiplier(struct clocktick_context const *ctx, int64_t const sleep_ns, double *multiplier) {
+    int status = clocktick_check_clock(ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (sleep_ns <= 0) {
+        return clocktick_error_argument;
+    }
+    struct timespec tp;
+    int64_t c1 = clocktick_get_timevalue(ctx);
+    clock_gettime(CLOCK_REALTIME, &tp);
+    int64_t t1 = s2ns(tp.tv_sec) + tp.tv_nsec;
+    const struct timespec req = {.tv_sec = sleep_ns / one_billion, .tv_nsec = sleep_ns % one_billion};
+    nanosleep(&req, 0);
+    int64_t c2 = clocktick_get_timevalue(ctx);
+    clock_gettime(CLOCK_REALTIME, &tp);
+    int64_t t2 = s2ns(tp.tv_sec) + tp.tv_nsec;
+
+    *multiplier = (double) (t2-t1)/(double) (c2-c1);
+    return clocktick_ok;
+}
+
+// Calculate one cyc in ns. Clocks that are already in ns get multiplier 1.
+int clocktick_calibrate(struct clocktick_context *ctx) {
+    int status = clocktick_check_clock(ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (clocktick_units_in_ns(ctx)) {
+        ctx->cyc2ns_multiplier = 1.0;
+        ctx->cyc2ns_multiplier_initialized = true;
+        return clocktick_ok;
+    }
+    status = clocktick_measure_multiplier(ctx, one_billion, &ctx->cyc2ns_multiplier);
+    if (status < 0) {
+        return status;
+    }
+    ctx->cyc2ns_multiplier_initialized = true;
+    return clocktick_ok;
+}
+
+// Convert a value in clock units to ns. Tsc clocks must be calibrated first:
+// the functions that convert return clocktick_error_not_calibrated before
+// getting here, so an uncalibrated context is a bug in the caller.
+int64_t clocktick_to_ns(struct clocktick_context const *ctx, int64_t const v) {
+    assert(clocktick_units_in_ns(ctx) || ctx->cyc2ns_multiplier_initialized);
+    if (clocktick_units_in_ns(ctx)) {
+        return v;
+    }
+    return (int64_t) ((double) v * ctx->cyc2ns_multiplier);
+}
+
+int64_t clocktick_from_ns(struct clocktick_context const *ctx, int64_t const ns) {
+    assert(clocktick_units_in_ns(ctx) || ctx->cyc2ns_multiplier_initialized);
+    if (clocktick_units_in_ns(ctx)) {
+        return ns;
+    }
+    return (int64_t) ((double) ns / ctx->cyc2ns_multiplier);
+}
+
+int clocktick_run_percentile_test(struct clocktick_context const *context, int64_t *results, uint64_t const number_of_iterations) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    int64_t prev, next;
+    prev = clocktick_get_timevalue(&ctx);
+    for (uint64_t i = 0; i < number_of_iterations; i++) {
+        next = clocktick_get_timevalue(&ctx);
+        results[i] = next - prev;
+        prev = next;
+    }
+    return clocktick_ok;
+}
+
+// Same as the percentile test, but the diffs of each cache line are collected
+// in registers and written with non-temporal stores, so the result array does
+// not go through the cache of the measuring core.
+int clocktick_run_percentile_test_streaming(struct clocktick_context const *context, int64_t *results, uint64_t const number_of_iterations) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    int64_t prev, next;
+    uint64_t i = 0;
+    prev = clocktick_get_timevalue(&ctx);
+    // Plain stores until a cache line starts, the array is at least 8 byte aligned
+    while (i < number_of_iterations && (uintptr_t) &results[i] % streaming_line_bytes != 0) {
+        next = clocktick_get_timevalue(&ctx);
+        results[i++] = next - prev;
+        prev = next;
+    }
+    while (i + streaming_line_values <= number_of_iterations) {
+        int64_t line[streaming_line_values];
+        for (int j = 0; j < streaming_line_values; j++) {
+            next = clocktick_get_timevalue(&ctx);
+            line[j] = next - prev;
+            prev = next;
+        }
+        for (int j = 0; j < streaming_line_values; j++) {
+            _mm_stream_si64((long long *) &results[i + j], line[j]);
+        }
+        i += streaming_line_values;
+    }
+    _mm_sfence();
+    while (i < number_of_iterations) {
+        next = clocktick_get_timevalue(&ctx);
+        results[i++] = next - prev;
+        prev = next;
+    }
+    return clocktick_ok;
+}
+
+// Same as the percentile test, but stops when duration (in clock units) has
+// passed or results is full. The number of results is returned in nbr_results.
+int clocktick_run_burst(struct clocktick_context const *context, int64_t const duration, int64_t *results, uint64_t const max_results, uint64_t *nbr_results) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    int64_t prev, next;
+    uint64_t i = 0;
+    prev = clocktick_get_timevalue(&ctx);
+    int64_t const deadline = prev + duration;
+    while (i < max_results && prev < deadline) {
+        next = clocktick_get_timevalue(&ctx);
+        results[i++] = next - prev;
+        prev = next;
+    }
+    *nbr_results = i;
+    return clocktick_ok;
+}
+
+// results must have room for n values, and they are returned in ascending order
+int clocktick_run_highest_test(struct clocktick_context const *context, uint64_t const number_of_iterations, int64_t *results, unsigned int const n) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (n == 0) {
+        return clocktick_error_argument;
+    }
+    int64_t prev, next, diff;
+    memset(results, 0, n * sizeof(int64_t));
+    prev = clocktick_get_timevalue(&ctx);
+    for (uint64_t i = 0; i < number_of_iterations; i++) {
+        next = clocktick_get_timevalue(&ctx);
+        diff = next - prev;
+        prev = next;
+        if (diff > results[0]) {  // results[0] is the smallest value of the n
+            results[0] = diff;
+            qsort(results, n, sizeof(int64_t), &int_comparison);
+        }
+    }
+    return clocktick_ok;
+}
+
+// Same as the highest test, but calls hook for the diffs above its threshold
+int clocktick_run_highest_test_with_hook(struct clocktick_context const *context, uint64_t const number_of_iterations, int64_t *results, unsigned int const n, \
+                                         struct clocktick_jump_hook const *jump_hook) {
+    struct clocktick_context const ctx = *context;
+    struct clocktick_jump_hook const hook = *jump_hook;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (n == 0 || hook.callback == NULL) {
+        return clocktick_error_argument;
+    }
+    int64_t prev, next, diff;
+    memset(results, 0, n * sizeof(int64_t));
+    prev = clocktick_get_timevalue(&ctx);
+    for (uint64_t i = 0; i < number_of_iterations; i++) {
+        next = clocktick_get_timevalue(&ctx);
+        diff = next - prev;
+        if (diff > results[0]) {  // results[0] is the smallest value of the n
+            results[0] = diff;
+            qsort(results, n, sizeof(int64_t), &int_comparison);
+        }
+        if (diff > hook.threshold) {
+            hook.callback(prev, diff, hook.arg);
+            next = clocktick_get_timevalue(&ctx);
+        }
+        prev = next;
+    }
+    return clocktick_ok;
+}
+
+// results must have room for number_of_iterations events. The first one holds
+// the start time.
+int clocktick_run_cumulative_test_with_baseline(struct clocktick_context const *context, uint64_t const number_of_iterations, int64_t const baseline, struct cumulative_test_results *results) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (number_of_iterations == 0) {
+        return clocktick_error_argument;
+    }
+    int64_t prev, next;
+    memset(results, 0, number_of_iterations * sizeof(struct cumulative_test_results));
+    prev = clocktick_get_timevalue(&ctx);
+    // Use first value for start time
+    results[0].timestamp = prev;
+    uint64_t index=1;
+    while (index < number_of_iterations) {
+        next = clocktick_get_timevalue(&ctx);
+        if (next-prev > baseline) {
+            results[index].timestamp = prev;
+            results[index].diff = (next-prev) - baseline;
+            index++;
+        }
+        prev = next;
+    }
+    return clocktick_ok;
+}
+
+// Same as the cumulative test, but calls hook for the events whose diff is
+// above its threshold
+int clocktick_run_cumulative_test_with_hook(struct clocktick_context const *context, uint64_t const number_of_iterations, int64_t const baseline, \
+                                            struct cumulative_test_results *results, struct clocktick_jump_hook const *jump_hook) {
+    struct clocktick_context const ctx = *context;
+    struct clocktick_jump_hook const hook = *jump_hook;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (number_of_iterations == 0 || hook.callback == NULL) {
+        return clocktick_error_argument;
+    }
+    int64_t prev, next;
+    memset(results, 0, number_of_iterations * sizeof(struct cumulative_test_results));
+    prev = clocktick_get_timevalue(&ctx);
+    results[0].timestamp = prev;
+    uint64_t index=1;
+    while (index < number_of_iterations) {
+        next = clocktick_get_timevalue(&ctx);
+        if (next-prev > baseline) {
+            results[index].timestamp = prev;
+            results[index].diff = (next-prev) - baseline;
+            index++;
+            if (next-prev > hook.threshold) {
+                hook.callback(prev, next-prev, hook.arg);
+                next = clocktick_get_timevalue(&ctx);
+            }
+        }
+        prev = next;
+    }
+    return clocktick_ok;
+}
+
+// Average diff over nbr_reads reads of the clock
+int clocktick_get_average_diff(struct clocktick_context const *context, uint64_t const nbr_reads, int64_t *average) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (nbr_reads == 0) {
+        return clocktick_error_argument;
+    }
+    int64_t sum = 0;
+    int64_t prev, next;
+    prev = clocktick_get_timevalue(&ctx);
+    for (uint64_t i = 0; i < nbr_reads; i++) {
+        next = clocktick_get_timevalue(&ctx);
+        sum +=  next - prev;
+        prev = next;
+    }
+    *average = (int64_t) ((double) sum/(double) nbr_reads);
+    return clocktick_ok;
+}
+
+int clocktick_get_baseline_time(struct clocktick_context const *ctx, int64_t *baseline) {
+    return clocktick_get_average_diff(ctx, one_million, baseline);
+}
+
+static int get_baseline(struct clocktick_context const *ctx, int64_t *baseline) {
+    int status = clocktick_get_baseline_time(ctx, baseline);
+    if (status < 0) {
+        return status;
+    }
+    *baseline *= 2;
+    return (*baseline == 0) ? clocktick_error_baseline : clocktick_ok;
+}
+
+// Returns the baseline used in baseline
+int clocktick_run_cumulative_test(struct clocktick_context const *ctx, uint64_t const number_of_iterations, struct cumulative_test_results *results, int64_t *baseline) {
+    int status = get_baseline(ctx, baseline);
+    if (status < 0) {
+        return status;
+    }
+    return clocktick_run_cumulative_test_with_baseline(ctx, number_of_iterations, *baseline, results);
+}
+
+// Like clocktick_run_cumulative_test_with_baseline, but appends the events to a
+// compact event store. Stops early if the store gets full.
+int clocktick_run_cumulative_test_compact_with_baseline(struct clocktick_context const *context, uint64_t const number_of_iterations, int64_t const baseline, struct event_store *store, uint64_t *nbr_events) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    int64_t prev, next;
+    prev = clocktick_get_timevalue(&ctx);
+    // Use first event for start time
+    if (event_store_append(store, prev, 0)) {
+        while (store->nbr_events < number_of_iterations) {
+            next = clocktick_get_timevalue(&ctx);
+            if (next-prev > baseline) {
+                if (!event_store_append(store, prev, (next-prev) - baseline)) {
+                    // Grow the full store and start the next diff after it,
+                    // so that the allocation is not measured
+                    if (event_store_grow(store) < 0 || !event_store_append(store, prev, (next-prev) - baseline)) {
+                        break;
+                    }
+                    next = clocktick_get_timevalue(&ctx);
+                }
+            }
+            prev = next;
+        }
+    }
+    *nbr_events = store->nbr_events;
+    return clocktick_ok;
+}
+
+int clocktick_run_cumulative_test_compact(struct clocktick_context const *ctx, uint64_t const number_of_iterations, struct event_store *store, int64_t *baseline) {
+    int status = get_baseline(ctx, baseline);
+    if (status < 0) {
+        return status;
+    }
+    uint64_t nbr_events;
+    return clocktick_run_cumulative_test_compact_with_baseline(ctx, number_of_iterations, *baseline, store, &nbr_events);
+}
+
+// Both are done with the vectorized kernels of simd.c when the CPU has them
+void find_highest_values(struct cumulative_test_results *results, uint64_t nbr_results, int64_t *highest_values, unsigned int const nbr_highest_values) {
+    simd_find_highest_values(results, nbr_results, highest_values, nbr_highest_values);
+}
+
+void find_highest_cumulative_values(struct cumulative_test_results *results, uint64_t nbr_results, int64_t *highest_values, unsigned int const nbr_highest_values, int64_t time_interval) {
+    simd_find_highest_cumulative_values(results, nbr_results, highest_values, nbr_highest_values, time_interval);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef CLOCKTICK_H
+#define CLOCKTICK_H
+
+// libclocktick: the measurement and analysis code of clocktick_jumps as an
+// embeddable library. All state lives in a struct clocktick_context owned by
+// the caller, functions return a negative enum clocktick_status on errors
+// instead of exiting, and results are written to buffers given by the caller.
+// Different contexts can be used from different threads at the same time.
+
+#include <time.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define one_million       1000000LL
+#define hundred_million 100000000LL
+#define one_billion    1000000000LL
+
+enum clocktick_status {
+    clocktick_ok = 0,
+    clocktick_error_clocktype = -1,
+    clocktick_error_not_calibrated = -2,
+    clocktick_error_baseline = -3,
+    clocktick_error_argument = -4,
+    clocktick_error_system = -5
+};
+
+// clocktype is 'r' for CLOCK_REALTIME, 't' for rdtsc, 'p' for rdtscp, or
+// 'm' for a mock clock that calls mock_clock (for testing)
+struct clocktick_context {
+    char clocktype;
+    double cyc2ns_multiplier;
+    bool cyc2ns_multiplier_initialized;
+    int64_t (*mock_clock)(bool);
+};
+
+struct cumulative_test_results {
+    int64_t timestamp;
+    int64_t diff;
+};
+
+struct event_store;
+
+// Called by the measurement loops with the start (in clock units) and the
+// length (in clock units) of each diff above threshold. The loop reads the
+// clock again after the callback, so the time spent in it is not a diff.
+struct clocktick_jump_hook {
+    int64_t threshold;
+    void (*callback)(int64_t const, int64_t const, void *);
+    void *arg;
+};
+
+char const *clocktick_strerror(int const);
+int clocktick_init(struct clocktick_context *, char const);
+int clocktick_calibrate(struct clocktick_context *);
+int clocktick_measure_multiplier(struct clocktick_context const *, int64_t const, double *);
+int clocktick_check_clock(struct clocktick_context const *);
+bool clocktick_units_in_ns(struct clocktick_context const *);
+int64_t clocktick_to_ns(struct clocktick_context const *, int64_t const);
+int64_t clocktick_from_ns(struct clocktick_context const *, int64_t const);
+int clocktick_get_baseline_time(struct clocktick_context const *, int64_t *);
+int clocktick_get_average_diff(struct clocktick_context const *, uint64_t const, int64_t *);
+int clocktick_run_percentile_test(struct clocktick_context const *, int64_t *, uint64_t const);
+int clocktick_run_percentile_test_streaming(struct clocktick_context const *, int64_t *, uint64_t const);
+int clocktick_run_burst(struct clocktick_context const *, int64_t const, int64_t *, uint64_t const, uint64_t *);
+int clocktick_run_highest_test(struct clocktick_context const *, uint64_t const, int64_t *, unsigned int const);
+int clocktick_run_highest_test_with_hook(struct clocktick_context const *, uint64_t const, int64_t *, unsigned int const, struct clocktick_jump_hook const *);
+int clocktick_run_cumulative_test_with_baseline(struct clocktick_context const *, uint64_t const, int64_t const, struct cumulative_test_results *);
+int clocktick_run_cumulative_test_with_hook(struct clocktick_context const *, uint64_t const, int64_t const, struct cumulative_test_results *, struct clocktick_jump_hook const *);
+int clocktick_run_cumulative_test(struct clocktick_context const *, uint64_t const, struct cumulative_test_results *, int64_t *);
+int clocktick_run_cumulative_test_compact_with_baseline(struct clocktick_context const *, uint64_t const, int64_t const, struct event_store *, uint64_t *);
+int clocktick_run_cumulative_test_compact(struct clocktick_context const *, uint64_t const, struct event_store *, int64_t *);
+void find_highest_values(struct cumulative_test_results *, uint64_t, int64_t *, unsigned int const);
+void find_highest_cumulative_values(struct cumulative_test_results *, uint64_t, int64_t *, unsigned int const, int64_t);
+int64_t s2ns(int64_t const);
+int64_t ns2s(int64_t const);
+
+static inline int64_t get_tsc_with_rdtscp(void) {
+    register uint32_t high, low;
+    __asm__ volatile (
+        "cpuid;"
+        "rdtscp;"
+        "movl %%eax, %[low];"
+        "movl %%edx, %[high];"
+        : [high] "=r"(high), [low]  "=r"(low)
+        :
+        : "eax", "ebx", "ecx", "edx");
+    return (((int64_t) high << 32) | low);
+}
+
+static inline int64_t get_tsc_aux_with_rdtscp(uint32_t *tsc_aux) {
+    register uint32_t high, low, aux;
+    __asm__ volatile (
+        "cpuid;"
+        "rdtscp;"
+        "movl %%eax, %[low];"
+        "movl %%edx, %[high];"
+        "movl %%ecx, %[aux]"
+        : [high] "=r"(high), [low]  "=r"(low), [aux] "=r"(aux)
+        :
+        : "eax", "ebx", "ecx", "edx");
+    *tsc_aux = aux;
+    return (((int64_t) high << 32) | low);
+}
+
+static inline int64_t get_tsc_with_rdtsc(void) {
+    register uint32_t high, low;
+    __asm__ volatile (
+        "lfence;"
+        "rdtsc;"
+        "movl %%eax, %[low];"
+        "movl %%edx, %[high]"
+        : [high] "=r"(high), [low]  "=r"(low)
+        :
+        : "eax", "ebx", "ecx", "edx");
+    return (int64_t) ( ( (int64_t)  high) << 32 | low);
+}
+
+static inline int64_t get_clock_realtime(void) {
+	struct timespec tp;
+    clock_gettime(CLOCK_REALTIME, &tp);
+    return tp.tv_nsec + s2ns(tp.tv_sec);
+}
+
+// The measurement loops copy the context to a local variable first, so that
+// the compiler can move the clock type test out of the loop.
+static inline int64_t clocktick_get_timevalue(struct clocktick_context const *ctx) {
+    if (ctx->clocktype == 'r') {
+        return get_clock_realtime();
+    } else if (ctx->clocktype == 't') {
+        return get_tsc_with_rdtsc();
+    } else if (ctx->clocktype == 'p') {
+        return get_tsc_with_rdtscp();
+    }
+    return ctx->mock_clock(false);
+}
+
+#endif // CLOCKTICK_H
@@ -16,6 +16,21 @@
 #include <inttypes.h>
 #include <sys/resource.h>
 #include "clocktick_jumps.h"
+#include "event_store.h"
+#include "correlated_test.h"
+#include "wakeup_test.h"
+#include "histogram.h"
+#include "sentinel.h"
+#include "simd.h"
+#include "series.h"
+#include "calibration_cache.h"
+#include "adaptive.h"
+#include "result_summary.h"
+#include "diff_store.h"
+#include "handoff_test.h"
+#include "exit_cost.h"
+#include "throughput_test.h"
+#include "flight_recorder.h"
 
 #ifdef UNIT_TESTING
 // Redefine main since unit tests have their own main
@@ -33,6 +48,14 @@ char const *clock_name_p = "rdtscp";
 char const *reporttype_name_p = "percentiles";
 char const *reporttype_name_h = "highest";
 char const *reporttype_name_c = "cumulative";
+char const *reporttype_name_x = "correlated";
+char const *reporttype_name_w = "wakeup";
+char const *reporttype_name_s = "sentinel";
+char const *reporttype_name_i = "series";
+char const *reporttype_name_a = "adaptive";
+char const *reporttype_name_f = "handoff";
+char const *reporttype_name_v = "vmexit";
+char const *reporttype_name_g = "throughput";
 
 bool clock_units_in_ns(char const clocktype) {
         if (clocktype == 'r' || clocktype == 'm') {
@@ -55,16 +78,47 @@ struct command_line_arguments default_arguments = {
     .reporttype = 'p',\
     .reportname = &reporttype_name_p,\
     .time_interval_ns = one_million,\
-    .iterations = 10
+    .iterations = 10,\
+    .compact_events = false,\
+    .streaming_stores = false,\
+    .short_diffs = false,\
+    .nbr_correlated_cpus = 0,\
+    .stall_threshold_ns = 1000,\
+    .duration_s = 10,\
+    .wakeup_method = 'n',\
+    .wakeup_method_name = &wakeup_method_name_n,\
+    .burst_ns = 200000,\
+    .period_ns = 50 * one_million,\
+    .cpu_budget_percent = 1.0,\
+    .series_interval_ns = one_billion,\
+    .series_interval_given = false,\
+    .window_ns = 100000,\
+    .flight_recorder_threshold_ns = 0,\
+    .flight_recorder_max_hits = 0,\
+    .tolerance_percent = 5.0,\
+    .summary_path = NULL,\
+    .nbr_labels = 0,\
+    .calibration_cache_path = NULL
 };
 
-int64_t s2ns(int64_t const secs) {
-    return one_billion * secs;
-}
+// Sentinel test reports every minute unless -I is given
+enum { sentinel_report_interval_s = 60 };
 
-int64_t ns2s(int64_t const ns) {
-    return (int64_t) ((double) ns/ (double) one_billion);
-}
+// Entries kept by series test. When they are used up, neighbouring entries
+// are merged, e.g. two hours of 1 s intervals become 3600 entries of 2 s.
+enum { series_max_entries = 4096 };
+
+// Expected average size of an encoded cumulative test event, used to size the
+// compact event store. This keeps 4 times more events than the plain array
+// in the same memory.
+enum { compact_event_bytes_estimate = sizeof(struct cumulative_test_results) / 4 };
+
+// Size of the overflow table of the compact percentile test: diffs that do not
+// fit in 16 bits (about 20 us at 3 GHz) are rare, one in 256 diffs is plenty.
+enum {
+    diff_store_overflow_ratio = 256,
+    diff_store_min_overflow = 4096
+};
 
 static int int_comparison(const void *i, const void *j) {
     return (*(int64_t const*) i < *(int64_t const*) j) ? -1:1; 
@@ -96,6 +150,28 @@ static int int_comparison(const void *i, const void *j) {
 //}
 //
 
+// Context for the original interface, using the process wide calibration
+struct clocktick_context clocktick_context_for(char const clocktype) {
+    struct clocktick_context ctx;
+    if (clocktick_init(&ctx, clocktype) < 0) {
+        printf("Unknown clock type %c, exiting\n", clocktype);
+        exit(-1);
+    }
+    ctx.cyc2ns_multiplier = cyc2ns_multiplier;
+    ctx.cyc2ns_multiplier_initialized = cyc2ns_multiplier_initialized;
+#ifdef UNIT_TESTING
+    ctx.mock_clock = &mock_get_timevalue;
+#endif //UNIT_TESTING
+    return ctx;
+}
+
+static void exit_on_error(int const status) {
+    if (status < 0) {
+        printf("%s, exiting\n", clocktick_strerror(status));
+        exit(-1);
+    }
+}
+
 int64_t cyc2ns(int64_t const cycles) {
         if (!cyc2ns_multiplier_initialized) {
             printf("Cycles to ns calculation not initialized\n");
@@ -113,30 +189,48 @@ int64_t ns2cyc(int64_t const ns) {
 }
 
 void initialize_cyc2ns_multiplier(char const clocktype) {
-        // Calculate one cyc in ns
-        int64_t (*get_ticks)(void);
-        if (clocktype == 'p') {
-            get_ticks = &get_tsc_with_rdtscp;
-        } else if (clocktype == 't') {
-            get_ticks = &get_tsc_with_rdtsc;
-        } else {
+        if (clocktype != 'p' && clocktype != 't') {
             printf("Unknown clock type in cyc2ns, exiting\n");
             exit(-1);
         }
-        struct timespec tp;
-        int64_t c1 = (*get_ticks)();
-        clock_gettime(CLOCK_REALTIME, &tp);
-        int64_t t1 = s2ns(tp.tv_sec) + tp.tv_nsec;
-        const struct timespec req = {.tv_sec=1, .tv_nsec=0};
-        nanosleep(&req, 0);
-        int64_t c2 = (*get_ticks)();
-        clock_gettime(CLOCK_REALTIME, &tp);
-        int64_t t2 = s2ns(tp.tv_sec) + tp.tv_nsec;
-
-        cyc2ns_multiplier = (double) (t2-t1)/(double) (c2-c1);
+        struct clocktick_context ctx = clocktick_context_for(clocktype);
+        exit_on_error(clocktick_calibrate(&ctx));
+        cyc2ns_multiplier = ctx.cyc2ns_multiplier;
         cyc2ns_multiplier_initialized = true; 
 }
 
+// Uses the cached multiplier if a short check agrees with it
+static void initialize_cyc2ns_multiplier_cached(char const clocktype, struct calibration_cache *cache) {
+    struct clocktick_context ctx = clocktick_context_for(clocktype);
+    bool cached;
+    exit_on_error(clocktick_calibrate_cached(&ctx, cache, &cached));
+    if (cached) {
+        printf("Using cached multiplier for cycles to ns\n");
+    }
+    cyc2ns_multiplier = ctx.cyc2ns_multiplier;
+    cyc2ns_multiplier_initialized = true;
+}
+
+// Twice the average diff, as in the cumulative test of the library
+static int64_t get_cumulative_baseline(struct command_line_arguments const *cl, struct calibration_cache *cache) {
+    int64_t baseline;
+    if (cache == NULL) {
+        baseline = get_baseline_time(cl->clocktype);
+    } else {
+        struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+        bool cached;
+        exit_on_error(clocktick_get_baseline_time_cached(&ctx, cache, cl->cpu_pin, &baseline, &cached));
+        if (cached) {
+            printf("Using cached baseline\n");
+        }
+    }
+    baseline *= 2;
+    if (baseline == 0) {
+        exit_on_error(clocktick_error_baseline);
+    }
+    return baseline;
+}
+
 struct timecounter {
     long long user_time;
     long long system_time;
@@ -171,22 +265,12 @@ static void print_ns_and_cyc_if_needed(int64_t ns, char const clocktype) {
 }
 
 int64_t get_timevalue(char const clocktype) {
-    if (clocktype == 'r') {
-        return get_clock_realtime();
-    } else if (clocktype == 't') {
-       return get_tsc_with_rdtsc();
-    } else if (clocktype == 'p') {
-        return get_tsc_with_rdtscp();
-    } 
-
-#ifdef UNIT_TESTING
-    if (clocktype == 'm') {
-        return mock_get_timevalue(false);
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    if (ctx.clocktype == 'm' && ctx.mock_clock == NULL) {
+        printf("Unknown clocktype in get_timevalue, exiting");
+        exit(-1);
     }
-#endif //UNIT_TESTING 
-
-    printf("Unknown clocktype in get_timevalue, exiting");
-    exit(-1);
+    return clocktick_get_timevalue(&ctx);
 }
 
 int64_t get_timevalue_in_ns(char const clocktype) {
@@ -199,109 +283,65 @@ int64_t get_timevalue_in_ns(char const clocktype) {
 }
 
 int64_t* run_percentile_test(uint64_t const number_of_iterations, char const clocktype) {
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
     // malloc is ok since we will overwrite the memory
     int64_t *results = malloc(number_of_iterations * sizeof(uint64_t));
-    int64_t prev, next;
-    prev = get_timevalue(clocktype);
-    for (uint64_t i = 0; i < number_of_iterations; i++) {
-        next = get_timevalue(clocktype);
-        results[i] = next - prev;
-        prev = next;
-    }
+    exit_on_error(clocktick_run_percentile_test(&ctx, results, number_of_iterations));
+    return results;
+}
+
+int64_t* run_percentile_test_streaming(uint64_t const number_of_iterations, char const clocktype) {
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    int64_t *results = malloc(number_of_iterations * sizeof(uint64_t));
+    exit_on_error(clocktick_run_percentile_test_streaming(&ctx, results, number_of_iterations));
     return results;
 }
 
 int64_t* run_highest_test(uint64_t const number_of_iterations, char const clocktype, uint const n) {
-        int64_t prev, next, diff;
+        struct clocktick_context const ctx = clocktick_context_for(clocktype);
         int64_t *results = calloc(n+1, sizeof(int64_t));
-        prev = get_timevalue(clocktype);
-        for (uint64_t i = 0; i < number_of_iterations; i++) {
-	        next = get_timevalue(clocktype); 
-            diff = next - prev;
-            prev = next;
-            if (diff > results[0]) {  // results[0] is the smallest value of the 10
-                results[0] = diff;
-                qsort(results, n, sizeof(int64_t), &int_comparison);
-            }
-        }
+        exit_on_error(clocktick_run_highest_test(&ctx, number_of_iterations, results, n));
         return results;
 }
 
 struct cumulative_test_results* run_cumulative_test_with_baseline(uint64_t const number_of_iterations, int64_t const baseline, char const clocktype) {
-        int64_t prev, next;
+        struct clocktick_context const ctx = clocktick_context_for(clocktype);
         struct cumulative_test_results *results = calloc(number_of_iterations+1, sizeof(struct cumulative_test_results));
+        exit_on_error(clocktick_run_cumulative_test_with_baseline(&ctx, number_of_iterations, baseline, results));
         // Misuse last value for baseline
         results[number_of_iterations].timestamp = baseline;
- 
-        prev = get_timevalue(clocktype);
-        // Use first value for start time
-        results[0].timestamp = prev;
-        uint64_t index=1;
-        while (index < number_of_iterations) {
-            next = get_timevalue(clocktype);
-            if (next-prev > baseline) {
-                results[index].timestamp = prev;
-                results[index].diff = (next-prev) - baseline;
-                index++;
-            }
-            prev = next;
-        }
         return results;
 }
 
 int64_t get_baseline_time(char const clocktype) {
-    int64_t sum = 0;
-    int64_t prev, next;
-    prev = get_timevalue(clocktype);
-    for (int i = 0; i < one_million; i++) {
-        next = get_timevalue(clocktype);
-        sum +=  next - prev;
-        prev = next;
-    }
-    return (int64_t) ((double) sum/(double) one_million);
-}
-
-static int64_t get_baseline(char const clocktype) {
-    return 2*get_baseline_time(clocktype);   
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    int64_t baseline;
+    exit_on_error(clocktick_get_baseline_time(&ctx, &baseline));
+    return baseline;
 }
 
 struct cumulative_test_results* 
 run_cumulative_test(uint64_t const number_of_iterations, char const clocktype) {
-    int64_t const baseline = get_baseline(clocktype);
-    if (baseline == 0) {
-        printf("Calculating baseline failed, exiting\n");
-        exit(-1);
-    }
-    return run_cumulative_test_with_baseline(number_of_iterations, baseline, clocktype);
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    struct cumulative_test_results *results = calloc(number_of_iterations+1, sizeof(struct cumulative_test_results));
+    int64_t baseline;
+    exit_on_error(clocktick_run_cumulative_test(&ctx, number_of_iterations, results, &baseline));
+    results[number_of_iterations].timestamp = baseline;
+    return results;
 }
 
-
-void find_highest_values(struct cumulative_test_results *results, uint64_t nbr_results, int64_t *highest_values, unsigned int const nbr_highest_values) {
-    for (uint64_t i = 0; i < nbr_results; i++) {
-        if (results[i].diff > highest_values[0]) {
-            highest_values[0] = results[i].diff;
-            qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
-        }
-    };
-    qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+uint64_t run_cumulative_test_compact_with_baseline(uint64_t const number_of_iterations, int64_t const baseline, char const clocktype, struct event_store *store) {
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    uint64_t nbr_events;
+    exit_on_error(clocktick_run_cumulative_test_compact_with_baseline(&ctx, number_of_iterations, baseline, store, &nbr_events));
+    return nbr_events;
 }
 
-
-void find_highest_cumulative_values(struct cumulative_test_results *results, uint64_t nbr_results, int64_t *highest_values, unsigned int const nbr_highest_values, int64_t time_interval) {
-        int64_t start = results[0].timestamp;
-        int64_t sum = 0;
-        for (uint64_t i = 0; i < nbr_results; i++) {
-            sum += results[i].diff;
-            if (results[i].timestamp >= start + time_interval) {
-                start = results[i].timestamp;
-                if (sum > highest_values[0]) {
-                        highest_values[0] = sum;
-                        qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
-                }
-                sum = 0;
-            }
-        }
-        qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+int64_t run_cumulative_test_compact(uint64_t const number_of_iterations, char const clocktype, struct event_store *store) {
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    int64_t baseline;
+    exit_on_error(clocktick_run_cumulative_test_compact(&ctx, number_of_iterations, store, &baseline));
+    return baseline;
 }
 
 void print_usage() {
@@ -311,10 +351,49 @@ void print_usage() {
     asprintf(&result, "%s \n    (REALTIME refers to the clock type in POSIX function clock_gettime)", result);
     asprintf(&result, "%s \n    default is %s", result, *default_arguments.clockname);
     asprintf(&result, "%s \n-p c: pin the process to CPU number c", result);
-    asprintf(&result, "%s \n-r reporttype: report percentiles, highest, or cumulative", result);
+    asprintf(&result, "%s \n-r reporttype: report percentiles, highest, cumulative, correlated, wakeup, sentinel, series, adaptive, handoff, vmexit, or throughput", result);
     asprintf(&result, "%s \n-t time_interval: how long to run each iteration (in ns) for cumulative test", result);
+    asprintf(&result, "%s \n    and the wakeup period for wakeup test", result);
     asprintf(&result, "%s \n    default is %li", result, default_arguments.time_interval_ns);
     asprintf(&result, "%s \n-i iterations: how many iterations to run", result);
+    asprintf(&result, "%s \n-z: store cumulative test events in a compact delta encoded form", result);
+    asprintf(&result, "%s \n-N: write percentile test results with non-temporal stores that bypass the cache", result);
+    asprintf(&result, "%s \n-S: store percentile test diffs in 16 bits, can not be used with -N", result);
+    asprintf(&result, "%s \n-P cpus: list of CPUs (e.g. 1,2,4-7) sampled at the same time in correlated test", result);
+    asprintf(&result, "%s \n-s threshold: smallest jump (in ns) counted as a stall in correlated test", result);
+    asprintf(&result, "%s \n    default is %li", result, default_arguments.stall_threshold_ns);
+    asprintf(&result, "%s \n-d duration: how long to run correlated test (in s), 0 runs sentinel test until it is stopped", result);
+    asprintf(&result, "%s \n    default is %li", result, default_arguments.duration_s);
+    asprintf(&result, "%s \n    -i is the maximum number of stalls recorded per CPU in correlated test", result);
+    asprintf(&result, "%s \n-w method: how to sleep in wakeup test: nanosleep, timerfd, or hybrid (sleep, then spin)", result);
+    asprintf(&result, "%s \n    default is %s", result, *default_arguments.wakeup_method_name);
+    asprintf(&result, "%s \n-b burst: how long each burst of sentinel test runs (in ns)", result);
+    asprintf(&result, "%s \n    default is %li", result, default_arguments.burst_ns);
+    asprintf(&result, "%s \n-e period: how often sentinel test runs a burst (in ns)", result);
+    asprintf(&result, "%s \n    default is %li", result, default_arguments.period_ns);
+    asprintf(&result, "%s \n-u budget: maximum CPU usage of sentinel test (in per cent of one CPU)", result);
+    asprintf(&result, "%s \n    default is %g", result, default_arguments.cpu_budget_percent);
+    asprintf(&result, "%s \n    sentinel test runs for -d seconds, rotates bursts over the -P CPUs and reports every minute, or every -I ns", result);
+    asprintf(&result, "%s \n-I interval: length of one interval of series test (in ns)", result);
+    asprintf(&result, "%s \n    default is %li", result, default_arguments.series_interval_ns);
+    asprintf(&result, "%s \n    series test runs for -d seconds and reports the percentiles of every interval", result);
+    asprintf(&result, "%s \n    handoff test bounces a cache line -i times between the two -P CPUs, or between all pairs of more CPUs", result);
+    asprintf(&result, "%s \n    vmexit test times -i runs of cpuid, pause and a system call against two plain rdtsc reads", result);
+    asprintf(&result, "%s \n-W window: length of one window of throughput test (in ns)", result);
+    asprintf(&result, "%s \n    default is %li", result, default_arguments.window_ns);
+    asprintf(&result, "%s \n    throughput test counts iterations per window for -d seconds and reports them every -I ns", result);
+    asprintf(&result, "%s \n-T tolerance: largest half width of the confidence intervals of adaptive test (in per cent)", result);
+    asprintf(&result, "%s \n    default is %g", result, default_arguments.tolerance_percent);
+    asprintf(&result, "%s \n    adaptive test runs until the intervals are narrower, but at most -d seconds", result);
+    asprintf(&result, "%s \n-o file: save the results of percentile and highest tests as a summary that cj_merge can merge", result);
+    asprintf(&result, "%s \n-L key=value: label of the summary, e.g. -L rack=12, can be given many times", result);
+    asprintf(&result, "%s \n    host, kernel, cpu_model, clocksource, hypervisor, test and clock are added automatically", result);
+    asprintf(&result, "%s \n-F threshold: write a kernel trace marker for each jump longer than threshold (in ns)", result);
+    asprintf(&result, "%s \n    in highest and cumulative tests, and save the ftrace buffer next to the report", result);
+    asprintf(&result, "%s \n-H hits: stop tracing after hits marked jumps, 0 keeps tracing", result);
+    asprintf(&result, "%s \n    default is %lu", result, default_arguments.flight_recorder_max_hits);
+    asprintf(&result, "%s \n-C file: file for cached calibration results, none disables the cache", result);
+    asprintf(&result, "%s \n    default is $XDG_CACHE_HOME/clocktick_calibration or ~/.cache/clocktick_calibration", result);
     printf("%s\n", result);
 }
 
@@ -323,7 +402,7 @@ int parse_command_line(int argc, char **argv, struct command_line_arguments *cl)
     #ifdef UNIT_TESTING
     optind=1; // setting optind to 1 makes this function idempotent
     #endif // UNIT_TESTING
-    while ((opt = getopt(argc, argv, "c:p:r:t:i:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:p:r:t:i:zNSP:s:d:w:b:e:u:I:W:T:o:L:F:H:C:")) != -1) {
         switch (opt) {
         case 'c':
             if (!strcmp(optarg, clock_name_r)) {
@@ -357,6 +436,30 @@ int parse_command_line(int argc, char **argv, struct command_line_arguments *cl)
             } else if (!strcmp(optarg, reporttype_name_c)) {
                 cl->reporttype = 'c';
                 cl->reportname = &reporttype_name_c;
+            } else if (!strcmp(optarg, reporttype_name_x)) {
+                cl->reporttype = 'x';
+                cl->reportname = &reporttype_name_x;
+            } else if (!strcmp(optarg, reporttype_name_w)) {
+                cl->reporttype = 'w';
+                cl->reportname = &reporttype_name_w;
+            } else if (!strcmp(optarg, reporttype_name_s)) {
+                cl->reporttype = 's';
+                cl->reportname = &reporttype_name_s;
+            } else if (!strcmp(optarg, reporttype_name_i)) {
+                cl->reporttype = 'i';
+                cl->reportname = &reporttype_name_i;
+            } else if (!strcmp(optarg, reporttype_name_a)) {
+                cl->reporttype = 'a';
+                cl->reportname = &reporttype_name_a;
+            } else if (!strcmp(optarg, reporttype_name_f)) {
+                cl->reporttype = 'f';
+                cl->reportname = &reporttype_name_f;
+            } else if (!strcmp(optarg, reporttype_name_v)) {
+                cl->reporttype = 'v';
+                cl->reportname = &reporttype_name_v;
+            } else if (!strcmp(optarg, reporttype_name_g)) {
+                cl->reporttype = 'g';
+                cl->reportname = &reporttype_name_g;
             } else {
                 printf("Unknown report type %s", optarg);
                 return -1;
@@ -397,14 +500,676 @@ int parse_command_line(int argc, char **argv, struct command_line_arguments *cl)
                 cl->iterations = (uint64_t) i;
             }
             break;
+        case 'z':
+            cl->compact_events = true;
+            break;
+        case 'N':
+            cl->streaming_stores = true;
+            break;
+        case 'S':
+            cl->short_diffs = true;
+            break;
+        case 'P':
+            cl->nbr_correlated_cpus = parse_cpu_list(optarg, cl->correlated_cpus, max_correlated_cpus);
+            if (cl->nbr_correlated_cpus <= 0) {
+                printf("Invalid CPU list %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 's':
+            {
+                char *endptr;
+                errno = 0;
+                cl->stall_threshold_ns = strtoll(optarg, &endptr, 10);
+                if (errno != 0 || *endptr != '\0' || cl->stall_threshold_ns <= 0) {
+                    printf("Invalid stall threshold %s\n", optarg);
+                    return -1;
+                }
+            }
+            break;
+        case 'd':
+            {
+                char *endptr;
+                errno = 0;
+                cl->duration_s = strtoll(optarg, &endptr, 10);
+                if (errno != 0 || *endptr != '\0' || cl->duration_s < 0) {
+                    printf("Invalid duration %s\n", optarg);
+                    return -1;
+                }
+            }
+            break;
+        case 'w':
+            if (!strcmp(optarg, wakeup_method_name_n)) {
+                cl->wakeup_method = 'n';
+                cl->wakeup_method_name = &wakeup_method_name_n;
+            } else if (!strcmp(optarg, wakeup_method_name_f)) {
+                cl->wakeup_method = 'f';
+                cl->wakeup_method_name = &wakeup_method_name_f;
+            } else if (!strcmp(optarg, wakeup_method_name_h)) {
+                cl->wakeup_method = 'h';
+                cl->wakeup_method_name = &wakeup_method_name_h;
+            } else {
+                printf("Unknown wakeup method %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'b':
+        case 'e':
+            {
+                char *endptr;
+                errno = 0;
+                int64_t ns = strtoll(optarg, &endptr, 10);
+                if (errno != 0 || *endptr != '\0' || ns <= 0) {
+                    printf("Invalid %s %s\n", opt == 'b' ? "burst" : "period", optarg);
+                    return -1;
+                }
+                if (opt == 'b') {
+                    cl->burst_ns = ns;
+                } else {
+                    cl->period_ns = ns;
+                }
+            }
+            break;
+        case 'I':
+            {
+                char *endptr;
+                errno = 0;
+                cl->series_interval_ns = strtoll(optarg, &endptr, 10);
+                if (errno != 0 || *endptr != '\0' || cl->series_interval_ns <= 0) {
+                    printf("Invalid series interval %s\n", optarg);
+                    return -1;
+                }
+                cl->series_interval_given = true;
+            }
+            break;
+        case 'W':
+            {
+                char *endptr;
+                errno = 0;
+                cl->window_ns = strtoll(optarg, &endptr, 10);
+                if (errno != 0 || *endptr != '\0' || cl->window_ns <= 0) {
+                    printf("Invalid window %s\n", optarg);
+                    return -1;
+                }
+            }
+            break;
+        case 'F':
+        case 'H':
+            {
+                char *endptr;
+                errno = 0;
+                long long const value = strtoll(optarg, &endptr, 10);
+                if (errno != 0 || *endptr != '\0' || value < 0 || (opt == 'F' && value == 0)) {
+                    printf("Invalid %s %s\n", opt == 'F' ? "trace threshold" : "number of hits", optarg);
+                    return -1;
+                }
+                if (opt == 'F') {
+                    cl->flight_recorder_threshold_ns = value;
+                } else {
+                    cl->flight_recorder_max_hits = (uint64_t) value;
+                }
+            }
+            break;
+        case 'T':
+            {
+                char *endptr;
+                errno = 0;
+                cl->tolerance_percent = strtod(optarg, &endptr);
+                if (errno != 0 || *endptr != '\0' || cl->tolerance_percent <= 0) {
+                    printf("Invalid tolerance %s\n", optarg);
+                    return -1;
+                }
+            }
+            break;
+        case 'o':
+            cl->summary_path = optarg;
+            break;
+        case 'L':
+            if (strchr(optarg, '=') == NULL || cl->nbr_labels == max_summary_labels) {
+                printf("Invalid label %s\n", optarg);
+                return -1;
+            }
+            cl->labels[cl->nbr_labels++] = optarg;
+            break;
+        case 'C':
+            cl->calibration_cache_path = optarg;
+            break;
+        case 'u':
+            {
+                char *endptr;
+                errno = 0;
+                cl->cpu_budget_percent = strtod(optarg, &endptr);
+                if (errno != 0 || *endptr != '\0' || cl->cpu_budget_percent <= 0 || cl->cpu_budget_percent > 100) {
+                    printf("Invalid CPU budget %s\n", optarg);
+                    return -1;
+                }
+            }
+            break;
         default: /* '?' */
             print_usage();
             return -1;
         }
     }
+    if (cl->duration_s == 0 && cl->reporttype != 's') {
+        printf("Only sentinel test can run until it is stopped (-d 0)\n");
+        return -1;
+    }
+    // Both change how the percentile test stores its diffs
+    if (cl->short_diffs && cl->streaming_stores) {
+        printf("-S and -N can not be used together\n");
+        return -1;
+    }
     return 0; // everything cool
 }
 
+// Print the first values, the largest values and the percentiles. Sorts results.
+static void report_percentiles(int64_t *results, uint64_t const iterations, char const clocktype) {
+    // Analyze results
+    printf("\nFirst 10 values are:\n");
+    for (int i=0; i<10; i++) {
+        print_ns_and_cyc_if_needed(results[i], clocktype);  
+    }
+
+    qsort(results, iterations, sizeof(uint64_t), &int_comparison);
+
+    printf("\nLargest 10 values are:\n");
+    for (unsigned int i=0; i<10; i++) {
+        int64_t c = results[iterations-1-i];
+        print_ns_and_cyc_if_needed(c, clocktype);
+    }   
+
+    printf("\nPercentiles are:\n");
+    int number_of_percentiles = sizeof(percentiles)/sizeof(double);
+    for (int i=0; i<number_of_percentiles; i++) {
+            int index_for_percentile = (int) (iterations * percentiles[i]); 
+            printf("%f : ", percentiles[i]);
+            print_ns_and_cyc_if_needed(results[index_for_percentile], clocktype);
+    }
+}
+
+static void report_correlated_test(struct command_line_arguments const *cl) {
+    if (cl->nbr_correlated_cpus == 0) {
+        printf("Correlated test needs a list of CPUs (-P), exiting\n");
+        exit(-1);
+    }
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    struct correlated_test test = {
+        .nbr_cpus = cl->nbr_correlated_cpus,
+        .threshold_ns = cl->stall_threshold_ns,
+        .duration_ns = s2ns(cl->duration_s),
+        .max_stalls = cl->iterations
+    };
+    memcpy(test.cpus, cl->correlated_cpus, sizeof(test.cpus));
+    test.stalls = calloc(test.nbr_cpus * test.max_stalls, sizeof(struct stall_interval));
+    if (test.stalls == NULL) {
+        printf("Allocating memory for correlated test failed, exiting\n");
+        exit(-1);
+    }
+    exit_on_error(clocktick_run_correlated_test(&ctx, &test));
+
+    printf("\nSampler CPU socket    stalls\n");
+    for (int i = 0; i < test.nbr_cpus; i++) {
+        if (test.pinning_errors[i] != 0) {
+            printf("Pinning sampler to CPU %d failed\n", test.cpus[i]);
+        }
+        printf("%7d %3d %6d %9" PRIu64 "%s\n", i, test.cpus[i], test.sockets[i], test.nbr_stalls_per_cpu[i], \
+            test.nbr_stalls_per_cpu[i] == test.max_stalls ? " (stopped early, increase -i)" : "");
+    }
+    if (test.window_end == test.window_start) {
+        printf("Samplers did not run at the same time, are the CPUs distinct?\n");
+    }
+
+    printf("\nCommon sampling window was %" PRId64 " ns, stall threshold %" PRId64 " ns\n", \
+        clocktick_to_ns(&ctx, test.window_end - test.window_start), cl->stall_threshold_ns);
+    printf("class       count      wall time ns       cpu time ns        longest ns\n");
+    for (int c = 0; c < nbr_stall_classes; c++) {
+        struct stall_class_summary const *summary = &test.summary[c];
+        printf("%-8s %8" PRIu64 " %17" PRId64 " %17" PRId64 " %17" PRId64 "\n", stall_class_names[c], summary->count, \
+            clocktick_to_ns(&ctx, summary->wall_time), clocktick_to_ns(&ctx, summary->cpu_time), \
+            clocktick_to_ns(&ctx, summary->longest));
+    }
+    free(test.stalls);
+}
+
+struct sentinel_output {
+    struct clocktick_context const *ctx;
+    struct histogram total;
+};
+
+static void print_sentinel_report(struct sentinel_report const *r, void *arg) {
+    struct sentinel_output *out = arg;
+    struct clocktick_context const *ctx = out->ctx;
+    if (r->index == 0) {
+        printf("\ninterval   bursts    samples  cpu %%  period ms       p50 ns      p99 ns    p99.9 ns      max ns\n");
+    }
+    printf("%8" PRIu64 " %8" PRIu64 " %10" PRIu64 " %6.3f %10.1f %10" PRId64 "  %10" PRId64 "  %10" PRId64 "  %10" PRId64 "\n", \
+        r->index, r->nbr_bursts, r->interval->count, 100 * r->cpu_usage, (double) r->period_ns / one_million, \
+        clocktick_to_ns(ctx, histogram_percentile(r->interval, 0.5)), clocktick_to_ns(ctx, histogram_percentile(r->interval, 0.99)), \
+        clocktick_to_ns(ctx, histogram_percentile(r->interval, 0.999)), clocktick_to_ns(ctx, r->interval->max));
+    fflush(stdout);
+    out->total = *r->total;
+}
+
+static void report_sentinel_test(struct command_line_arguments const *cl) {
+    struct sentinel_config config = {
+        .burst_ns = cl->burst_ns,
+        .period_ns = cl->period_ns,
+        .cpu_budget = cl->cpu_budget_percent / 100,
+        .report_interval_ns = cl->series_interval_given ? cl->series_interval_ns : s2ns(sentinel_report_interval_s),
+        .duration_ns = s2ns(cl->duration_s),  // 0 runs forever
+        .nbr_cpus = cl->nbr_correlated_cpus
+    };
+    memcpy(config.cpus, cl->correlated_cpus, sizeof(config.cpus));
+    if (config.period_ns < config.burst_ns) {
+        printf("Sentinel period must be longer than the burst, exiting\n");
+        exit(-1);
+    }
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    struct sentinel_output *out = calloc(1, sizeof(struct sentinel_output));
+    out->ctx = &ctx;
+    printf("Running a %" PRId64 " ns burst every %" PRId64 " ns within a CPU budget of %g %%, reporting every %" PRId64 " ns\n", \
+        config.burst_ns, config.period_ns, cl->cpu_budget_percent, config.report_interval_ns);
+    exit_on_error(clocktick_run_sentinel(&ctx, &config, &print_sentinel_report, out));
+
+    printf("\nPercentiles over all bursts are:\n");
+    int number_of_percentiles = sizeof(percentiles)/sizeof(double);
+    for (int i=0; i<number_of_percentiles; i++) {
+            printf("%f : ", percentiles[i]);
+            print_ns_and_cyc_if_needed(histogram_percentile(&out->total, percentiles[i]), cl->clocktype);
+    }
+    printf("max      : ");
+    print_ns_and_cyc_if_needed(out->total.max, cl->clocktype);
+    free(out);
+}
+
+static void print_series_report(struct series_report const *r, void *arg) {
+    struct clocktick_context const *ctx = arg;
+    if (r->index == 0) {
+        printf("\n  start s    samples      p50 ns    p99.9 ns      max ns\n");
+    }
+    printf("%9.3f %10" PRIu64 "  %10" PRId64 "  %10" PRId64 "  %10" PRId64 "\n", (double) r->start_ns / one_billion, r->interval->count, \
+        clocktick_to_ns(ctx, histogram_percentile(r->interval, 0.5)), clocktick_to_ns(ctx, histogram_percentile(r->interval, 0.999)), \
+        clocktick_to_ns(ctx, r->interval->max));
+    fflush(stdout);
+}
+
+static void report_series_test(struct command_line_arguments const *cl) {
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    struct histogram_series series;
+    exit_on_error(histogram_series_init(&series, cl->series_interval_ns, series_max_entries));
+    printf("Reporting percentiles every %" PRId64 " ns\n", cl->series_interval_ns);
+    exit_on_error(clocktick_run_series(&ctx, &series, s2ns(cl->duration_s), &print_series_report, (void *) &ctx));
+
+    struct histogram *total = malloc(sizeof(struct histogram));
+    histogram_series_range(&series, 0, INT64_MAX, total);
+    printf("\nSeries holds %" PRIu32 " entries of %" PRIu64 " intervals in %" PRIu64 " bytes\n", \
+        histogram_series_nbr_entries(&series), series.intervals_per_entry, histogram_series_bytes(&series));
+    printf("\nPercentiles over the whole run are:\n");
+    int number_of_percentiles = sizeof(percentiles)/sizeof(double);
+    for (int i=0; i<number_of_percentiles; i++) {
+            printf("%f : ", percentiles[i]);
+            print_ns_and_cyc_if_needed(histogram_percentile(total, percentiles[i]), cl->clocktype);
+    }
+    printf("max      : ");
+    print_ns_and_cyc_if_needed(total->max, cl->clocktype);
+    free(total);
+    histogram_series_free(&series);
+}
+
+// Summary with the labels of the run, values are added in ns
+static struct result_summary *new_summary(struct command_line_arguments const *cl) {
+    struct result_summary *summary = malloc(sizeof(struct result_summary));
+    result_summary_init(summary);
+    result_summary_add_system_labels(summary);
+    result_summary_set_label(summary, "test", *cl->reportname);
+    result_summary_set_label(summary, "clock", *cl->clockname);
+    for (int i = 0; i < cl->nbr_labels; i++) {
+        char key[sizeof(summary->labels[0].key)];
+        size_t const length = strcspn(cl->labels[i], "=");
+        snprintf(key, sizeof(key), "%.*s", (int) length, cl->labels[i]);
+        if (result_summary_set_label(summary, key, cl->labels[i] + length + 1) < 0) {
+            printf("Invalid label %s, exiting\n", cl->labels[i]);
+            exit(-1);
+        }
+    }
+    return summary;
+}
+
+static void save_and_free_summary(struct command_line_arguments const *cl, struct result_summary *summary) {
+    if (result_summary_save(summary, cl->summary_path) < 0) {
+        printf("Saving summary to %s failed, exiting\n", cl->summary_path);
+        exit(-1);
+    }
+    printf("Saved summary to %s\n", cl->summary_path);
+    free(summary);
+}
+
+// values are in clock units. If all_values is false, values are only the
+// largest values of the run.
+static void save_summary(struct command_line_arguments const *cl, int64_t const *values, uint64_t const n, bool const all_values) {
+    struct result_summary *summary = new_summary(cl);
+    bool const in_ns = clock_units_in_ns(cl->clocktype);
+    for (uint64_t i = 0; i < n; i++) {
+        int64_t const ns = in_ns ? values[i] : cyc2ns(values[i]);
+        if (all_values) {
+            result_summary_add_values(summary, &ns, 1);
+        } else {
+            result_summary_add_top(summary, ns);
+        }
+    }
+    save_and_free_summary(cl, summary);
+}
+
+// Percentile test with the diffs in a diff_store, reported like report_percentiles
+static void report_compact_percentile_test(struct command_line_arguments const *cl) {
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    struct diff_store store;
+    if (diff_store_init(&store, cl->iterations, cl->iterations / diff_store_overflow_ratio + diff_store_min_overflow) < 0) {
+        printf("Allocating compact diff store failed, exiting\n");
+        exit(-1);
+    }
+    exit_on_error(clocktick_run_percentile_test_compact(&ctx, &store));
+    printf("Stored %" PRIu64 " diffs in %" PRIu64 " bytes, %" PRIu64 " in the overflow table\n", \
+        store.nbr_diffs, diff_store_bytes(&store), store.nbr_overflow);
+    if (store.nbr_diffs < cl->iterations) {
+        printf("Overflow table got full, the test stopped early\n");
+    }
+    if (store.nbr_diffs < 10) {
+        printf("Too few diffs, exiting\n");
+        exit(-1);
+    }
+    exit_on_error(diff_store_sort(&store));
+
+    printf("\nFirst 10 values are:\n");
+    for (int i=0; i<10; i++) {
+        print_ns_and_cyc_if_needed(diff_store_get(&store, i), cl->clocktype);
+    }
+    printf("\nLargest 10 values are:\n");
+    for (unsigned int i=0; i<10; i++) {
+        print_ns_and_cyc_if_needed(diff_store_value_at_rank(&store, store.nbr_diffs-1-i), cl->clocktype);
+    }
+    printf("\nPercentiles are:\n");
+    int number_of_percentiles = sizeof(percentiles)/sizeof(double);
+    for (int i=0; i<number_of_percentiles; i++) {
+            printf("%f : ", percentiles[i]);
+            print_ns_and_cyc_if_needed(diff_store_percentile(&store, percentiles[i]), cl->clocktype);
+    }
+
+    if (cl->summary_path != NULL) {
+        struct result_summary *summary = new_summary(cl);
+        bool const in_ns = clock_units_in_ns(cl->clocktype);
+        for (uint64_t i = 0; i < store.nbr_diffs; i++) {
+            int64_t const value = diff_store_get(&store, i);
+            int64_t const ns = in_ns ? value : cyc2ns(value);
+            result_summary_add_values(summary, &ns, 1);
+        }
+        save_and_free_summary(cl, summary);
+    }
+    diff_store_free(&store);
+}
+
+static void print_handoff_matrix(struct handoff_matrix const *matrix, int64_t const *values, char const *name, struct clocktick_context const *ctx) {
+    int const n = matrix->nbr_cpus;
+    printf("\n%s round trip in ns\n  cpu", name);
+    for (int j = 0; j < n; j++) {
+        printf(" %6d", matrix->cpus[j]);
+    }
+    printf("\n");
+    for (int i = 0; i < n; i++) {
+        printf("%5d", matrix->cpus[i]);
+        for (int j = 0; j < n; j++) {
+            if (i == j) {
+                printf("      -");
+            } else {
+                printf(" %6" PRId64, clocktick_to_ns(ctx, values[i * n + j]));
+            }
+        }
+        printf("\n");
+    }
+}
+
+static void report_handoff_test(struct command_line_arguments const *cl) {
+    if (cl->nbr_correlated_cpus < 2) {
+        printf("Handoff test needs at least two CPUs (-P), exiting\n");
+        exit(-1);
+    }
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    if (cl->nbr_correlated_cpus == 2) {
+        printf("Bouncing a cache line between CPUs %d and %d (%s)\n", cl->correlated_cpus[0], cl->correlated_cpus[1], \
+            handoff_class_names[handoff_get_pair_class(cl->correlated_cpus[0], cl->correlated_cpus[1])]);
+        int64_t *results = malloc(cl->iterations * sizeof(int64_t));
+        exit_on_error(clocktick_run_handoff_test(&ctx, cl->correlated_cpus[0], cl->correlated_cpus[1], results, cl->iterations));
+        report_percentiles(results, cl->iterations, cl->clocktype);
+        free(results);
+        return;
+    }
+
+    struct handoff_matrix matrix = {.nbr_cpus = cl->nbr_correlated_cpus, .round_trips = cl->iterations};
+    memcpy(matrix.cpus, cl->correlated_cpus, cl->nbr_correlated_cpus * sizeof(int));
+    int const n = matrix.nbr_cpus;
+    matrix.median = malloc(n * n * sizeof(int64_t));
+    matrix.p99 = malloc(n * n * sizeof(int64_t));
+    printf("Bouncing a cache line %" PRIu64 " times between each pair of %d CPUs\n", cl->iterations, n);
+    exit_on_error(clocktick_run_handoff_matrix(&ctx, &matrix));
+    print_handoff_matrix(&matrix, matrix.median, "Median", &ctx);
+    print_handoff_matrix(&matrix, matrix.p99, "99%", &ctx);
+
+    // Pairs that share a core, a cache or a socket are averaged as a class
+    int64_t sums[nbr_handoff_classes] = {0};
+    int counts[nbr_handoff_classes] = {0};
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) {
+            enum handoff_pair_class const c = handoff_get_pair_class(matrix.cpus[i], matrix.cpus[j]);
+            sums[c] += matrix.median[i * n + j];
+            counts[c]++;
+        }
+    }
+    printf("\nclass    pairs  average median ns\n");
+    for (int c = 0; c < nbr_handoff_classes; c++) {
+        if (counts[c] > 0) {
+            printf("%-8s %5d  %17" PRId64 "\n", handoff_class_names[c], counts[c], clocktick_to_ns(&ctx, sums[c] / counts[c]));
+        }
+    }
+    free(matrix.median);
+    free(matrix.p99);
+}
+
+static void report_exit_cost_test(struct command_line_arguments const *cl) {
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    int64_t *results = malloc(cl->iterations * sizeof(int64_t));
+    int number_of_percentiles = sizeof(percentiles)/sizeof(double);
+    printf("Timing %" PRIu64 " runs of each operation between two rdtsc reads, in cycles\n\n", cl->iterations);
+    printf("%-17s %8s", "operation", "min");
+    for (int i=0; i<number_of_percentiles; i++) {
+        printf(" %8g%%", 100 * percentiles[i]);
+    }
+    printf(" %9s %10s\n", "max", "cost ns");
+    int64_t control = 0;
+    for (int k = 0; k < exit_cost_nbr_default_ops; k++) {
+        struct exit_cost_op const *op = &exit_cost_default_ops[k];
+        exit_on_error(clocktick_run_exit_cost(&ctx, op, results, cl->iterations));
+        qsort(results, cl->iterations, sizeof(int64_t), &int_comparison);
+        int64_t const median = results[cl->iterations / 2];
+        // The cost is the median over the median of the control
+        if (op->kind == 'n') {
+            control = median;
+        }
+        printf("%-17s %8" PRId64, op->name, results[0]);
+        for (int i=0; i<number_of_percentiles; i++) {
+            printf(" %9" PRId64, results[(uint64_t) (cl->iterations * percentiles[i])]);
+        }
+        printf(" %9" PRId64 " %10" PRId64 "\n", results[cl->iterations - 1], clocktick_to_ns(&ctx, median - control));
+        fflush(stdout);
+    }
+    free(results);
+}
+
+static int uint32_comparison(const void *i, const void *j) {
+    uint32_t const a = *(uint32_t const *) i, b = *(uint32_t const *) j;
+    return (a < b) ? -1 : (a > b);
+}
+
+// Windows below this per cent of the median are counted as slow
+enum { throughput_slow_percent = 80 };
+
+static void report_throughput_test(struct command_line_arguments const *cl) {
+    static double const low_percentiles[] = {0.000001, 0.00001, 0.0001, 0.001, 0.01, 0.1, 0.5, 0.9};
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    uint64_t const nbr_windows = s2ns(cl->duration_s) / cl->window_ns;
+    uint64_t const windows_per_interval = (cl->series_interval_ns > cl->window_ns) ? cl->series_interval_ns / cl->window_ns : 1;
+    if (nbr_windows == 0) {
+        printf("Duration is shorter than one window, exiting\n");
+        exit(-1);
+    }
+    uint32_t *counts = malloc(nbr_windows * sizeof(uint32_t));
+    uint32_t *sorted = malloc((nbr_windows > windows_per_interval ? nbr_windows : windows_per_interval) * sizeof(uint32_t));
+    printf("Counting iterations in %" PRIu64 " windows of %" PRId64 " ns\n", nbr_windows, cl->window_ns);
+    exit_on_error(clocktick_run_throughput_test(&ctx, cl->window_ns, counts, nbr_windows));
+
+    memcpy(sorted, counts, nbr_windows * sizeof(uint32_t));
+    qsort(sorted, nbr_windows, sizeof(uint32_t), &uint32_comparison);
+    double const median = sorted[nbr_windows / 2] ? sorted[nbr_windows / 2] : 1;
+    uint64_t nbr_slow = 0, nbr_empty = 0;
+    for (uint64_t i = 0; i < nbr_windows; i++) {
+        nbr_slow += (100 * counts[i] < throughput_slow_percent * median);
+        nbr_empty += (counts[i] == 0);
+    }
+
+    printf("\n  start s  windows     lowest         1%%     median   lowest %%   median %%\n");
+    for (uint64_t start = 0; start < nbr_windows; start += windows_per_interval) {
+        uint64_t const n = (nbr_windows - start < windows_per_interval) ? nbr_windows - start : windows_per_interval;
+        memcpy(sorted, &counts[start], n * sizeof(uint32_t));
+        qsort(sorted, n, sizeof(uint32_t), &uint32_comparison);
+        printf("%9.3f %8" PRIu64 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %9.1f %10.1f\n", (double) (start * cl->window_ns) / one_billion, n, \
+            sorted[0], sorted[n / 100], sorted[n / 2], 100 * sorted[0] / median, 100 * sorted[n / 2] / median);
+    }
+
+    memcpy(sorted, counts, nbr_windows * sizeof(uint32_t));
+    qsort(sorted, nbr_windows, sizeof(uint32_t), &uint32_comparison);
+    printf("\nMedian is %.0f iterations per window (%.1f million per s)\n", median, median * one_billion / cl->window_ns / one_million);
+    printf("\nLowest percentiles of iterations per window are:\n");
+    for (unsigned int i = 0; i < sizeof(low_percentiles) / sizeof(low_percentiles[0]); i++) {
+        uint32_t const c = sorted[(uint64_t) (nbr_windows * low_percentiles[i])];
+        printf("%f : %10" PRIu32 " (%5.1f %% of the median)\n", low_percentiles[i], c, 100 * c / median);
+    }
+    printf("\n%" PRIu64 " windows (%.3f %%) ran below %d %% of the median, %" PRIu64 " windows had no iterations\n", \
+        nbr_slow, 100.0 * nbr_slow / nbr_windows, throughput_slow_percent, nbr_empty);
+    free(counts);
+    free(sorted);
+}
+
+static int64_t *run_highest_test_with_hook(uint64_t const number_of_iterations, char const clocktype, unsigned int const n, struct clocktick_jump_hook const *hook) {
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    int64_t *results = calloc(n+1, sizeof(int64_t));
+    exit_on_error(clocktick_run_highest_test_with_hook(&ctx, number_of_iterations, results, n, hook));
+    return results;
+}
+
+static struct cumulative_test_results *run_cumulative_test_with_hook(uint64_t const number_of_iterations, int64_t const baseline, char const clocktype, \
+                                                                     struct clocktick_jump_hook const *hook) {
+    struct clocktick_context const ctx = clocktick_context_for(clocktype);
+    struct cumulative_test_results *results = calloc(number_of_iterations+1, sizeof(struct cumulative_test_results));
+    exit_on_error(clocktick_run_cumulative_test_with_hook(&ctx, number_of_iterations, baseline, results, hook));
+    // Misuse last value for baseline, like run_cumulative_test_with_baseline
+    results[number_of_iterations].timestamp = baseline;
+    return results;
+}
+
+// The recorder changes system wide tracefs settings, so it is stopped at exit,
+// also when the test exits on an error
+static struct flight_recorder *active_recorder = NULL;
+static char active_trace_path[4096];
+
+static void stop_flight_recorder(void);
+
+static struct flight_recorder *start_flight_recorder(struct command_line_arguments const *cl, struct clocktick_jump_hook *hook) {
+    if ((cl->reporttype != 'h' && cl->reporttype != 'c') || cl->compact_events) {
+        printf("Trace markers work with highest and cumulative tests without -z, exiting\n");
+        exit(-1);
+    }
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    struct flight_recorder *recorder = malloc(sizeof(struct flight_recorder));
+    int const status = flight_recorder_open(recorder, &ctx, NULL, cl->flight_recorder_max_hits);
+    if (status == clocktick_error_system) {
+        printf("Opening trace_marker in tracefs failed (are you root?), exiting\n");
+        exit(-1);
+    }
+    exit_on_error(status);
+    // The trace goes next to the summary, or to the current directory
+    snprintf(active_trace_path, sizeof(active_trace_path), "%s.trace", cl->summary_path ? cl->summary_path : "clocktick_jumps");
+    active_recorder = recorder;
+    if (atexit(&stop_flight_recorder) != 0) {
+        stop_flight_recorder();
+        printf("Registering the trace cleanup failed, exiting\n");
+        exit(-1);
+    }
+    hook->threshold = clocktick_from_ns(&ctx, cl->flight_recorder_threshold_ns);
+    hook->callback = &flight_recorder_mark;
+    hook->arg = recorder;
+    printf("Marking jumps longer than %" PRId64 " ns in the kernel trace of %s\n", cl->flight_recorder_threshold_ns, recorder->tracefs);
+    return recorder;
+}
+
+// Saves the trace and restores the tracefs settings, once
+static void stop_flight_recorder(void) {
+    struct flight_recorder *recorder = active_recorder;
+    if (recorder == NULL) {
+        return;
+    }
+    active_recorder = NULL;
+    char const *path = active_trace_path;
+    printf("Marked %" PRIu64 " jumps in the kernel trace%s\n", recorder->nbr_hits, recorder->stopped ? ", tracing was stopped" : "");
+    if (flight_recorder_save(recorder, path) < 0) {
+        printf("Saving the kernel trace to %s failed\n", path);
+    } else {
+        printf("Saved the kernel trace to %s\n", path);
+    }
+    flight_recorder_close(recorder);
+    free(recorder);
+}
+
+static void print_adaptive_progress(struct adaptive_result const *r, void *arg) {
+    (void) arg;
+    double widest = 0;
+    for (int i = 0; i < (int) (sizeof(percentiles)/sizeof(double)); i++) {
+        widest = (r->estimates[i].relative_width > widest) ? r->estimates[i].relative_width : widest;
+    }
+    printf("%11" PRIu64 " %8d  %8.2f %%\n", r->nbr_reads, r->nbr_batches, 100 * widest);
+    fflush(stdout);
+}
+
+static void report_adaptive_test(struct command_line_arguments const *cl) {
+    struct clocktick_context const ctx = clocktick_context_for(cl->clocktype);
+    struct adaptive_config const config = {
+        .percentiles = percentiles,
+        .nbr_percentiles = sizeof(percentiles)/sizeof(double),
+        .tolerance = cl->tolerance_percent / 100,
+        .duration_ns = s2ns(cl->duration_s),
+        .min_batch_reads = 0
+    };
+    struct adaptive_result *result = malloc(sizeof(struct adaptive_result));
+    printf("Running until the 95%% confidence intervals are within %g %%, at most %" PRId64 " s\n", \
+        cl->tolerance_percent, cl->duration_s);
+    printf("\n    samples  batches  widest interval\n");
+    exit_on_error(clocktick_run_adaptive(&ctx, &config, result, &print_adaptive_progress, NULL));
+
+    printf("\n%s after %" PRIu64 " samples in %d batches of %" PRIu64 "\n", result->converged ? "Converged" : "Did not converge", \
+        result->nbr_reads, result->nbr_batches, result->batch_reads);
+    printf("\npercentile       value ns   95%% interval ns            width\n");
+    for (int i = 0; i < config.nbr_percentiles; i++) {
+        struct adaptive_estimate const *e = &result->estimates[i];
+        if (e->half_width == INT64_MAX) {
+            printf("%f : %10" PRId64 "   unknown\n", e->percentile, clocktick_to_ns(&ctx, e->value));
+            continue;
+        }
+        printf("%f : %10" PRId64 "   %10" PRId64 " - %-10" PRId64 " %7.2f %%\n", e->percentile, clocktick_to_ns(&ctx, e->value), \
+            clocktick_to_ns(&ctx, e->value - e->half_width), clocktick_to_ns(&ctx, e->value + e->half_width), 100 * e->relative_width);
+    }
+    printf("max      : ");
+    print_ns_and_cyc_if_needed(result->total.max, cl->clocktype);
+    free(result);
+}
+
 int main(int argc, char **argv) {  
     struct command_line_arguments cl = default_arguments;
     int r = parse_command_line(argc, argv, &cl);
@@ -413,6 +1178,12 @@ int main(int argc, char **argv) {
             exit(EXIT_FAILURE);
     }
 
+    // Handoff and vmexit tests time with rdtsc
+    if ((cl.reporttype == 'f' || cl.reporttype == 'v') && cl.clocktype == 'r') {
+        cl.clocktype = 't';
+        cl.clockname = &clock_name_t;
+    }
+
     printf("\nRunning test %s with clock %s for %li iterations while pinning to processor %i\n", \
         *cl.reportname, *cl.clockname, cl.iterations, cl.cpu_pin);
     
@@ -431,8 +1202,20 @@ int main(int argc, char **argv) {
     CPU_SET(cl.cpu_pin, &set);
     sched_setaffinity(this_process_id, sizeof(cpu_set_t), &set);
                       
+    // Calibration results are cached over runs unless disabled with -C none
+    struct calibration_cache *cache = NULL;
+    char const *cache_path = cl.calibration_cache_path ? cl.calibration_cache_path : calibration_cache_default_path();
+    if (cache_path != NULL && strcmp(cache_path, "none") != 0) {
+        cache = malloc(sizeof(struct calibration_cache));
+        calibration_cache_load(cache, cache_path);
+    }
+
     if (!clock_units_in_ns(cl.clocktype)) {
-        initialize_cyc2ns_multiplier(cl.clocktype);
+        if (cache != NULL) {
+            initialize_cyc2ns_multiplier_cached(cl.clocktype, cache);
+        } else {
+            initialize_cyc2ns_multiplier(cl.clocktype);
+        }
     }
 
     // Set a real-time priority
@@ -443,54 +1226,124 @@ int main(int argc, char **argv) {
 
     struct timecounter start_testrun, end_testrun;
 
+    // Large jumps of the highest and cumulative tests are marked in the kernel trace
+    struct flight_recorder *recorder = NULL;
+    struct clocktick_jump_hook hook;
+    if (cl.flight_recorder_threshold_ns > 0) {
+        recorder = start_flight_recorder(&cl, &hook);
+    }
+
     get_timecounter(&start_testrun);
-    if (cl.reporttype == 'p') {
-        uint64_t iterations = cl.iterations;
-        char clocktype = cl.clocktype;
-        int64_t *results = run_percentile_test(iterations, cl.clocktype);
+    if (cl.reporttype == 'p' && cl.short_diffs) {
+        report_compact_percentile_test(&cl);
         get_timecounter(&end_testrun);
-   
-        // Analyze results
-        printf("\nFirst 10 values are:\n");
-        for (int i=0; i<10; i++) {
-            print_ns_and_cyc_if_needed(results[i], clocktype);  
+    } else if (cl.reporttype == 'p') {
+        int64_t *results = cl.streaming_stores ? run_percentile_test_streaming(cl.iterations, cl.clocktype) \
+                                               : run_percentile_test(cl.iterations, cl.clocktype);
+        get_timecounter(&end_testrun);
+        report_percentiles(results, cl.iterations, cl.clocktype);
+        if (cl.summary_path != NULL) {
+            save_summary(&cl, results, cl.iterations, true);
         }
-
-        qsort(results, iterations, sizeof(uint64_t), &int_comparison);
-
-        printf("\nLargest 10 values are:\n");
-        for (unsigned int i=0; i<10; i++) {
-            int64_t c = results[iterations-1-i];
-            print_ns_and_cyc_if_needed(c, clocktype);
-        }   
-
-        printf("\nPercentiles are:\n");
-        int number_of_percentiles = sizeof(percentiles)/sizeof(double);
-        for (int i=0; i<number_of_percentiles; i++) {
-                int index_for_percentile = (int) (iterations * percentiles[i]); 
-                printf("%f : ", percentiles[i]);
-                print_ns_and_cyc_if_needed(results[index_for_percentile], cl.clocktype);
-        }   
+    } else if (cl.reporttype == 'w') {
+        printf("Waking up every %" PRId64 " ns with %s\n", cl.time_interval_ns, *cl.wakeup_method_name);
+        struct clocktick_context const ctx = clocktick_context_for(cl.clocktype);
+        int64_t *results = malloc(cl.iterations * sizeof(int64_t));
+        exit_on_error(clocktick_run_wakeup_test(&ctx, cl.wakeup_method, cl.time_interval_ns, results, cl.iterations));
+        get_timecounter(&end_testrun);
+        report_percentiles(results, cl.iterations, cl.clocktype);
     } else if (cl.reporttype == 'h') {
-        int64_t *results = run_highest_test(cl.iterations, cl.clocktype, 10);
+        int64_t *results = recorder ? run_highest_test_with_hook(cl.iterations, cl.clocktype, 10, &hook) \
+                                    : run_highest_test(cl.iterations, cl.clocktype, 10);
         get_timecounter(&end_testrun);
         
         printf("Largest 10 values are:\n");
         for (int i=0; i<10; i++) {
             print_ns_and_cyc_if_needed(results[10-1-i], cl.clocktype);
         }   
+        if (cl.summary_path != NULL) {
+            save_summary(&cl, results, 10, false);
+        }
+    } else if (cl.reporttype == 's') {
+        report_sentinel_test(&cl);
+        get_timecounter(&end_testrun);
+    } else if (cl.reporttype == 'i') {
+        report_series_test(&cl);
+        get_timecounter(&end_testrun);
+    } else if (cl.reporttype == 'f') {
+        report_handoff_test(&cl);
+        get_timecounter(&end_testrun);
+    } else if (cl.reporttype == 'v') {
+        report_exit_cost_test(&cl);
+        get_timecounter(&end_testrun);
+    } else if (cl.reporttype == 'g') {
+        report_throughput_test(&cl);
+        get_timecounter(&end_testrun);
+    } else if (cl.reporttype == 'a') {
+        report_adaptive_test(&cl);
+        get_timecounter(&end_testrun);
+    } else if (cl.reporttype == 'x') {
+        report_correlated_test(&cl);
+        get_timecounter(&end_testrun);
+    } else if (cl.reporttype == 'c' && cl.compact_events) {
+        struct event_store store;
+        if (event_store_init(&store, cl.iterations * compact_event_bytes_estimate) < 0) {
+            printf("Allocating compact event store failed, exiting\n");
+            exit(-1);
+        }
+        int64_t baseline = get_cumulative_baseline(&cl, cache);
+        run_cumulative_test_compact_with_baseline(cl.iterations, baseline, cl.clocktype, &store);
+        get_timecounter(&end_testrun);
+        if (store.nbr_events < cl.iterations) {
+            printf("Growing the compact event store failed, the test stopped early after %" PRIu64 " events\n", store.nbr_events);
+        }
+        printf("Baseline for cumulative test is %" PRId64 " ns\n", baseline);
+        printf("Multiplier for cycles to ns is %g\n", cyc2ns_multiplier);
+        printf("Compact event store holds %" PRIu64 " events in %" PRIu64 " bytes (%.2f bytes per event), %" PRIu64 " bytes allocated\n", \
+            store.nbr_events, event_store_bytes_used(&store), (double) event_store_bytes_used(&store) / (double) store.nbr_events, \
+            event_store_bytes_allocated(&store));
+
+        // Timestamps stay in clock units, so convert the interval instead
+        int64_t time_interval = cl.time_interval_ns;
+        int64_t timespan = store.prev_timestamp - store.blocks[0].base_timestamp;
+        if (!clock_units_in_ns(cl.clocktype)) {
+            time_interval = ns2cyc(time_interval);
+            timespan = cyc2ns(timespan);
+        }
+
+        enum  { nbr_highest_values = 10 };
+        int64_t highest_values[nbr_highest_values] = {0};
+        int64_t highest_cum_values[nbr_highest_values] = {0};
+
+        printf("Test span was  %" PRId64 " ns (% " PRId64 " us, %" PRId64 " ms)\n", timespan, timespan/1000, (int64_t) (timespan/one_million));
+        printf("There are %" PRId64 " intervals of length %" PRId64 " ns (%" PRId64 " us, %" PRId64 " ms)\n", timespan/cl.time_interval_ns, cl.time_interval_ns, (int64_t) (cl.time_interval_ns/1000), (int64_t) (cl.time_interval_ns/one_million));
+
+        find_highest_values_in_event_store(&store, highest_values, nbr_highest_values);
+        printf("Largest %d individual values are\n", nbr_highest_values);
+        for (unsigned int i=0; i< nbr_highest_values; i++) {
+                printf("%16" PRId64 " ns (%8" PRId64" us)\n", highest_values[nbr_highest_values -1 -i], (int64_t) ((highest_values[nbr_highest_values-1-i]/1000)));
+        }
+        printf("\n");
+
+        find_highest_cumulative_values_in_event_store(&store, highest_cum_values, nbr_highest_values, time_interval);
+        printf("Largest %d cumulative values within %" PRIu64 " ns are:\n", nbr_highest_values, cl.time_interval_ns);
+        for (unsigned int i = 0; i < nbr_highest_values; i++) {
+                printf("%16" PRId64 " ns (%8" PRId64 " us)\n", highest_cum_values[nbr_highest_values - 1 - i], (int64_t) (highest_cum_values[nbr_highest_values-1-i]/1000));
+        }
+        event_store_free(&store);
     } else if (cl.reporttype == 'c') {
-        struct cumulative_test_results *results = run_cumulative_test(cl.iterations, cl.clocktype);
+        int64_t const cumulative_baseline = get_cumulative_baseline(&cl, cache);
+        struct cumulative_test_results *results = recorder ? run_cumulative_test_with_hook(cl.iterations, cumulative_baseline, cl.clocktype, &hook) \
+                                                           : run_cumulative_test_with_baseline(cl.iterations, cumulative_baseline, cl.clocktype);
         int64_t baseline = results[cl.iterations].timestamp;
         get_timecounter(&end_testrun);
         printf("Baseline for cumulative test is %" PRId64 " ns\n", baseline);
         printf("Multiplier for cycles to ns is %g\n", cyc2ns_multiplier); 
+        printf("Post-processing uses %s\n", simd_level_name(simd_get_level()));
     
         // Timestamps may be in cyc, need to convert to ns 
         if (!clock_units_in_ns(cl.clocktype)) {
-            for (uint64_t i = 0; i<cl.iterations; i++) {
-                results[i].timestamp = cyc2ns(results[i].timestamp);
-            }
+            simd_timestamps_to_ns(results, cl.iterations, cyc2ns_multiplier);
         }
         
         enum  { nbr_highest_values = 10 };
@@ -519,5 +1372,12 @@ int main(int argc, char **argv) {
         exit(-1);
     }
     print_timecounter_difference("Test run took ", &start_testrun, &end_testrun);
+    if (recorder != NULL) {
+        stop_flight_recorder();
+    }
+    if (cache != NULL) {
+        calibration_cache_save(cache, cache_path);
+        free(cache);
+    }
     return 0;
 }
@@ -4,11 +4,11 @@
  * SPDX-License-Identifier: BSD-3-Clause
 */
 
-#include <time.h>
-#include <sys/time.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <stdbool.h>
+#ifndef CLOCKTICK_JUMPS_H
+#define CLOCKTICK_JUMPS_H
+
+#include "clocktick.h"
+#include "correlated_test.h"
 
 extern char const *clock_name_r;
 extern char const *clock_name_t;
@@ -17,10 +17,16 @@ extern char const *clock_name_p;
 extern char const *reporttype_name_p;
 extern char const *reporttype_name_h;
 extern char const *reporttype_name_c;
+extern char const *reporttype_name_x;
+extern char const *reporttype_name_w;
+extern char const *reporttype_name_s;
+extern char const *reporttype_name_i;
+extern char const *reporttype_name_a;
+extern char const *reporttype_name_f;
+extern char const *reporttype_name_v;
+extern char const *reporttype_name_g;
 
-#define one_million       1000000LL
-#define hundred_million 100000000LL
-#define one_billion    1000000000LL
+enum { max_summary_labels = 8 };
 
 void print_usage(void);
 
@@ -32,22 +38,44 @@ struct command_line_arguments {
     char const **reportname;
     int64_t time_interval_ns;
     uint64_t iterations;
-};
-
-struct cumulative_test_results {
-    int64_t timestamp;
-    int64_t diff;
+    bool compact_events;
+    bool streaming_stores;
+    bool short_diffs;
+    int correlated_cpus[max_correlated_cpus];
+    int nbr_correlated_cpus;
+    int64_t stall_threshold_ns;
+    int64_t duration_s;
+    char wakeup_method;
+    char const **wakeup_method_name;
+    int64_t burst_ns;
+    int64_t period_ns;
+    double cpu_budget_percent;
+    int64_t series_interval_ns;
+    bool series_interval_given;
+    int64_t window_ns;
+    int64_t flight_recorder_threshold_ns;  // 0 disables trace markers
+    uint64_t flight_recorder_max_hits;
+    double tolerance_percent;
+    char const *summary_path;
+    char const *labels[max_summary_labels];    // key=value
+    int nbr_labels;
+    char const *calibration_cache_path;     // NULL for the default, "none" disables the cache
 };
 
 extern struct command_line_arguments default_arguments;
 
+// The functions below are the original interface of the command line tool.
+// They use process wide calibration and exit on errors, see clocktick.h
+// for the reentrant library interface.
+struct clocktick_context clocktick_context_for(char const);
 int parse_command_line(int, char **, struct command_line_arguments*);
 int64_t* run_percentile_test(uint64_t const, char const);
+int64_t* run_percentile_test_streaming(uint64_t const, char const);
 int64_t* run_highest_test(uint64_t const, char const, unsigned int const);
 struct cumulative_test_results* run_cumulative_test_with_baseline(uint64_t const, int64_t const, char const);
 struct cumulative_test_results* run_cumulative_test(uint64_t const, char const);
-void find_highest_values(struct cumulative_test_results *, uint64_t, int64_t *, unsigned int const);
-void find_highest_cumulative_values(struct cumulative_test_results *, uint64_t, int64_t *, unsigned int const, int64_t); 
+uint64_t run_cumulative_test_compact_with_baseline(uint64_t const, int64_t const, char const, struct event_store *);
+int64_t run_cumulative_test_compact(uint64_t const, char const, struct event_store *);
 
 int64_t cyc2ns(int64_t const);
 int64_t ns2cyc(int64_t const);
@@ -58,52 +86,5 @@ bool clock_units_in_ns(char const);
 int64_t get_timevalue(char const);
 int64_t get_timevalue_in_ns(char const);
 int64_t get_baseline_time(char const);
-int64_t s2ns(int64_t const);
-int64_t ns2s(int64_t const);
-
-static inline int64_t get_tsc_with_rdtscp(void) {
-    register uint32_t high, low;
-    __asm__ volatile (
-        "cpuid;"
-        "rdtscp;"
-        "movl %%eax, %[low];"
-        "movl %%edx, %[high];"
-        : [high] "=r"(high), [low]  "=r"(low)
-        :
-        : "eax", "ebx", "ecx", "edx");
-    return (((int64_t) high << 32) | low);
-}
-
-static inline int64_t get_tsc_aux_with_rdtscp(uint32_t *tsc_aux) {
-    register uint32_t high, low, aux;
-    __asm__ volatile (
-        "cpuid;"
-        "rdtscp;"
-        "movl %%eax, %[low];"
-        "movl %%edx, %[high];"
-        "movl %%ecx, %[aux]"
-        : [high] "=r"(high), [low]  "=r"(low), [aux] "=r"(aux)
-        :
-        : "eax", "ebx", "ecx", "edx");  
-    *tsc_aux = aux; 
-    return (((int64_t) high << 32) | low);
-}
-
-static inline int64_t get_tsc_with_rdtsc(void) {
-    register uint32_t high, low;
-    __asm__ volatile (
-        "lfence;"
-        "rdtsc;"
-        "movl %%eax, %[low];"
-        "movl %%edx, %[high]"
-        : [high] "=r"(high), [low]  "=r"(low)
-        :
-        : "eax", "ebx", "ecx", "edx");
-    return (int64_t) ( ( (int64_t)  high) << 32 | low);
-}
 
-static inline int64_t get_clock_realtime(void) {
-	struct timespec tp;
-    clock_gettime(CLOCK_REALTIME, &tp);
-    return tp.tv_nsec + s2ns(tp.tv_sec);
-}
+#endif // CLOCKTICK_JUMPS_H
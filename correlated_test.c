@@ -0,0 +1,271 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <pthread.h>
+#include "correlated_test.h"
+
+char const *stall_class_names[nbr_stall_classes] = {"global", "socket", "local"};
+
+// Samplers block until all of them have been created. They must not spin,
+// since the creating thread may be pinned to one of the sampled CPUs.
+struct correlated_start {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int state;  // 0 waiting, 1 run, -1 aborted
+};
+
+static void set_correlated_start(struct correlated_start *start, int const state) {
+    pthread_mutex_lock(&start->mutex);
+    start->state = state;
+    pthread_cond_broadcast(&start->cond);
+    pthread_mutex_unlock(&start->mutex);
+}
+
+struct correlated_sampler {
+    pthread_t thread;
+    struct correlated_start *start_signal;
+    struct clocktick_context ctx;
+    int index;
+    int cpu;
+    int64_t threshold;
+    int64_t duration;
+    uint64_t max_stalls;
+    struct stall_interval *stalls;
+    uint64_t nbr_stalls;
+    int64_t start;
+    int64_t end;
+    int error;
+};
+
+// Parse a list like "1,2,5-7" into cpus, returns the number of cpus or -1
+int parse_cpu_list(char const *list, int *cpus, int const max_cpus) {
+    int nbr_cpus = 0;
+    char const *p = list;
+    while (*p != '\0') {
+        char *endptr;
+        errno = 0;
+        long first = strtol(p, &endptr, 10);
+        if (errno != 0 || endptr == p || first < 0) {
+            return -1;
+        }
+        long last = first;
+        p = endptr;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &endptr, 10);
+            if (errno != 0 || endptr == p || last < first) {
+                return -1;
+            }
+            p = endptr;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (nbr_cpus == max_cpus) {
+                return -1;
+            }
+            cpus[nbr_cpus++] = (int) cpu;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    return nbr_cpus;
+}
+
+// Physical package of the cpu, or 0 if the topology is not available
+int get_cpu_socket(int const cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    int socket = 0;
+    if (fscanf(f, "%d", &socket) != 1) {
+        socket = 0;
+    }
+    fclose(f);
+    return socket;
+}
+
+static int stall_interval_comparison(const void *i, const void *j) {
+    return (((struct stall_interval const*) i)->start < ((struct stall_interval const*) j)->start) ? -1:1;
+}
+
+static enum stall_class classify_stall(uint64_t const mask, uint64_t const *socket_masks, int const nbr_samplers) {
+    uint64_t const all_samplers = (nbr_samplers == 64) ? ~0ULL : (1ULL << nbr_samplers) - 1;
+    if (nbr_samplers > 1 && mask == all_samplers) {
+        return stall_class_global;
+    }
+    for (int i = 0; i < nbr_samplers; i++) {
+        if ((mask & (1ULL << i)) && __builtin_popcountll(socket_masks[i]) > 1 && (mask & socket_masks[i]) == socket_masks[i]) {
+            return stall_class_socket;
+        }
+    }
+    return stall_class_local;
+}
+
+// Group the stalls of all samplers into clusters of overlapping intervals and
+// classify each cluster. Only stalls that start within [window_start, window_end)
+// are counted, since outside it not all samplers were running. Sorts stalls.
+void classify_correlated_stalls(struct stall_interval *stalls, uint64_t const nbr_stalls, int const *sampler_sockets, int const nbr_samplers, int64_t const window_start, int64_t const window_end, struct stall_class_summary *summary) {
+    uint64_t socket_masks[max_correlated_cpus] = {0};
+    for (int i = 0; i < nbr_samplers; i++) {
+        for (int j = 0; j < nbr_samplers; j++) {
+            if (sampler_sockets[i] == sampler_sockets[j]) {
+                socket_masks[i] |= 1ULL << j;
+            }
+        }
+    }
+    memset(summary, 0, nbr_stall_classes * sizeof(struct stall_class_summary));
+    qsort(stalls, nbr_stalls, sizeof(struct stall_interval), &stall_interval_comparison);
+
+    uint64_t i = 0;
+    while (i < nbr_stalls) {
+        if (stalls[i].start < window_start || stalls[i].start >= window_end) {
+            i++;
+            continue;
+        }
+        int64_t cluster_start = stalls[i].start;
+        int64_t cluster_end = stalls[i].end;
+        int64_t cpu_time = 0;
+        uint64_t mask = 0;
+        while (i < nbr_stalls && stalls[i].start <= cluster_end) {
+            if (stalls[i].end > cluster_end) {
+                cluster_end = stalls[i].end;
+            }
+            cpu_time += stalls[i].end - stalls[i].start;
+            mask |= 1ULL << stalls[i].sampler;
+            i++;
+        }
+        struct stall_class_summary *s = &summary[classify_stall(mask, socket_masks, nbr_samplers)];
+        s->count++;
+        s->wall_time += cluster_end - cluster_start;
+        s->cpu_time += cpu_time;
+        if (cluster_end - cluster_start > s->longest) {
+            s->longest = cluster_end - cluster_start;
+        }
+    }
+}
+
+static void *correlated_sampler_thread(void *arg) {
+    struct correlated_sampler *s = arg;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(s->cpu, &set);
+    s->error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+
+    pthread_mutex_lock(&s->start_signal->mutex);
+    while (s->start_signal->state == 0) {
+        pthread_cond_wait(&s->start_signal->cond, &s->start_signal->mutex);
+    }
+    int const state = s->start_signal->state;
+    pthread_mutex_unlock(&s->start_signal->mutex);
+    if (state < 0) {
+        return NULL;
+    }
+    struct clocktick_context const ctx = s->ctx;
+    int64_t const threshold = s->threshold;
+    struct stall_interval *stalls = s->stalls;
+    uint64_t n = 0;
+    int64_t prev, next;
+    prev = clocktick_get_timevalue(&ctx);
+    int64_t const deadline = prev + s->duration;
+    s->start = prev;
+    while (prev < deadline && n < s->max_stalls) {
+        next = clocktick_get_timevalue(&ctx);
+        if (next-prev > threshold) {
+            stalls[n].start = prev;
+            stalls[n].end = next;
+            stalls[n].sampler = s->index;
+            n++;
+        }
+        prev = next;
+    }
+    s->end = prev;
+    s->nbr_stalls = n;
+    return NULL;
+}
+
+int clocktick_run_correlated_test(struct clocktick_context const *ctx, struct correlated_test *test) {
+    int const nbr_samplers = test->nbr_cpus;
+    if (nbr_samplers <= 0 || nbr_samplers > max_correlated_cpus || test->max_stalls == 0 || test->stalls == NULL) {
+        return clocktick_error_argument;
+    }
+    if (ctx->clocktype == 'm') {
+        // The mock clock is not thread safe
+        return clocktick_error_clocktype;
+    }
+    if (!clocktick_units_in_ns(ctx) && !ctx->cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    struct correlated_sampler *samplers = calloc(nbr_samplers, sizeof(struct correlated_sampler));
+    if (samplers == NULL) {
+        return clocktick_error_system;
+    }
+
+    struct correlated_start start = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+    int nbr_started = 0;
+    for (int i = 0; i < nbr_samplers; i++) {
+        struct correlated_sampler *s = &samplers[i];
+        s->start_signal = &start;
+        s->ctx = *ctx;
+        s->index = i;
+        s->cpu = test->cpus[i];
+        s->threshold = clocktick_from_ns(ctx, test->threshold_ns);
+        s->duration = clocktick_from_ns(ctx, test->duration_ns);
+        s->max_stalls = test->max_stalls;
+        s->stalls = &test->stalls[i * test->max_stalls];
+        test->sockets[i] = get_cpu_socket(s->cpu);
+        if (pthread_create(&s->thread, NULL, &correlated_sampler_thread, s) != 0) {
+            break;
+        }
+        nbr_started++;
+    }
+    set_correlated_start(&start, (nbr_started < nbr_samplers) ? -1 : 1);
+    if (nbr_started < nbr_samplers) {
+        for (int i = 0; i < nbr_started; i++) {
+            pthread_join(samplers[i].thread, NULL);
+        }
+        free(samplers);
+        return clocktick_error_system;
+    }
+
+    test->window_start = INT64_MIN;
+    test->window_end = INT64_MAX;
+    test->nbr_stalls = 0;
+    for (int i = 0; i < nbr_samplers; i++) {
+        struct correlated_sampler *s = &samplers[i];
+        pthread_join(s->thread, NULL);
+        test->pinning_errors[i] = s->error;
+        test->nbr_stalls_per_cpu[i] = s->nbr_stalls;
+        if (s->start > test->window_start) {
+            test->window_start = s->start;
+        }
+        if (s->end < test->window_end) {
+            test->window_end = s->end;
+        }
+        // Compact the stalls to the beginning of the array
+        memmove(&test->stalls[test->nbr_stalls], s->stalls, s->nbr_stalls * sizeof(struct stall_interval));
+        test->nbr_stalls += s->nbr_stalls;
+    }
+    free(samplers);
+
+    // Samplers that did not run at the same time, e.g. on the same CPU
+    if (test->window_end < test->window_start) {
+        test->window_end = test->window_start;
+    }
+    classify_correlated_stalls(test->stalls, test->nbr_stalls, test->sockets, nbr_samplers, test->window_start, test->window_end, test->summary);
+    return clocktick_ok;
+}
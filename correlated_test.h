@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef CORRELATED_TEST_H
+#define CORRELATED_TEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Correlated test: run a sampler on several cores at the same time and match
+// the stalls across cores by their overlap in the shared clock timebase.
+// A stall that hits every sampled core is global (e.g. SMI), one that hits every
+// sampled core of a socket is socket-wide, and the rest are local (ticks, IRQs).
+
+enum { max_correlated_cpus = 64 };
+
+struct stall_interval {
+    int64_t start;
+    int64_t end;
+    int sampler;
+};
+
+enum stall_class {
+    stall_class_global,
+    stall_class_socket,
+    stall_class_local,
+    nbr_stall_classes
+};
+
+extern char const *stall_class_names[nbr_stall_classes];
+
+struct stall_class_summary {
+    uint64_t count;
+    int64_t wall_time;   // union of the overlapping stalls
+    int64_t cpu_time;    // sum of the stalls on all cores
+    int64_t longest;     // longest wall time of one stall
+};
+
+// The caller fills in the first part. Stalls must have room for
+// nbr_cpus * max_stalls intervals, and the found stalls are compacted to its
+// beginning. Times in the results are in clock units.
+struct correlated_test {
+    int cpus[max_correlated_cpus];
+    int nbr_cpus;
+    int64_t threshold_ns;
+    int64_t duration_ns;
+    uint64_t max_stalls;
+    struct stall_interval *stalls;
+
+    int sockets[max_correlated_cpus];
+    uint64_t nbr_stalls_per_cpu[max_correlated_cpus];
+    int pinning_errors[max_correlated_cpus];
+    uint64_t nbr_stalls;
+    int64_t window_start;
+    int64_t window_end;
+    struct stall_class_summary summary[nbr_stall_classes];
+};
+
+int parse_cpu_list(char const *, int *, int const);
+int get_cpu_socket(int const);
+void classify_correlated_stalls(struct stall_interval *, uint64_t const, int const *, int const, int64_t const, int64_t const, struct stall_class_summary *);
+int clocktick_run_correlated_test(struct clocktick_context const *, struct correlated_test *);
+
+#endif // CORRELATED_TEST_H
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "diff_store.h"
+
+int diff_store_init(struct diff_store *store, uint64_t const max_diffs, uint64_t const max_overflow) {
+    memset(store, 0, sizeof(*store));
+    if (max_diffs == 0 || max_overflow == 0) {
+        return clocktick_error_argument;
+    }
+    store->diffs = malloc(max_diffs * sizeof(uint16_t));
+    store->overflow = malloc(max_overflow * sizeof(struct diff_store_overflow_entry));
+    if (store->diffs == NULL || store->overflow == NULL) {
+        diff_store_free(store);
+        return clocktick_error_system;
+    }
+    store->max_diffs = max_diffs;
+    store->max_overflow = max_overflow;
+    return clocktick_ok;
+}
+
+void diff_store_free(struct diff_store *store) {
+    free(store->diffs);
+    free(store->overflow);
+    free(store->counts);
+    free(store->sorted_overflow);
+    memset(store, 0, sizeof(*store));
+}
+
+uint64_t diff_store_bytes(struct diff_store const *store) {
+    return store->max_diffs * sizeof(uint16_t) + store->max_overflow * sizeof(struct diff_store_overflow_entry);
+}
+
+// Diff number i in the order of the test
+int64_t diff_store_get(struct diff_store const *store, uint64_t const i) {
+    if (store->diffs[i] != diff_store_overflow) {
+        return store->diffs[i];
+    }
+    uint64_t low = 0, high = store->nbr_overflow;
+    while (low < high) {
+        uint64_t const middle = low + (high - low) / 2;
+        if (store->overflow[middle].index < i) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return store->overflow[low].value;
+}
+
+static int int_comparison(const void *i, const void *j) {
+    int64_t const a = *(int64_t const *) i, b = *(int64_t const *) j;
+    return (a < b) ? -1 : (a > b);
+}
+
+// After sorting, counts[v] is the number of 16 bit diffs up to v
+int diff_store_sort(struct diff_store *store) {
+    free(store->counts);
+    free(store->sorted_overflow);
+    store->counts = calloc(diff_store_overflow + 1, sizeof(uint64_t));
+    store->sorted_overflow = malloc((store->nbr_overflow + 1) * sizeof(int64_t));
+    if (store->counts == NULL || store->sorted_overflow == NULL) {
+        return clocktick_error_system;
+    }
+    for (uint64_t i = 0; i < store->nbr_diffs; i++) {
+        store->counts[store->diffs[i]]++;
+    }
+    for (unsigned int v = 1; v < diff_store_overflow; v++) {
+        store->counts[v] += store->counts[v - 1];
+    }
+    store->counts[diff_store_overflow] = 0;
+    store->nbr_negative = 0;
+    for (uint64_t i = 0; i < store->nbr_overflow; i++) {
+        store->sorted_overflow[i] = store->overflow[i].value;
+        store->nbr_negative += (store->overflow[i].value < 0);
+    }
+    qsort(store->sorted_overflow, store->nbr_overflow, sizeof(int64_t), &int_comparison);
+    return clocktick_ok;
+}
+
+// Value at index rank of the sorted diffs, needs diff_store_sort
+int64_t diff_store_value_at_rank(struct diff_store const *store, uint64_t rank) {
+    if (rank < store->nbr_negative) {
+        return store->sorted_overflow[rank];
+    }
+    rank -= store->nbr_negative;
+    uint64_t const nbr_small = store->counts[diff_store_overflow - 1];
+    if (rank >= nbr_small) {
+        return store->sorted_overflow[store->nbr_negative + rank - nbr_small];
+    }
+    unsigned int low = 0, high = diff_store_overflow - 1;
+    while (low < high) {
+        unsigned int const middle = low + (high - low) / 2;
+        if (store->counts[middle] <= rank) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Same definition as the percentile test, the value at index (int) (count * p)
+// of the sorted diffs. Needs diff_store_sort.
+int64_t diff_store_percentile(struct diff_store const *store, double const p) {
+    if (store->nbr_diffs == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) ((double) store->nbr_diffs * p);
+    if (rank >= store->nbr_diffs) {
+        rank = store->nbr_diffs - 1;
+    }
+    return diff_store_value_at_rank(store, rank);
+}
+
+// Same as the percentile test, but fills store with max_diffs diffs. Stops
+// early if the side table gets full, nbr_diffs tells how many diffs were
+// stored.
+int clocktick_run_percentile_test_compact(struct clocktick_context const *context, struct diff_store *store) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    uint16_t *const diffs = store->diffs;
+    struct diff_store_overflow_entry *const overflow = store->overflow;
+    uint64_t const max_diffs = store->max_diffs;
+    uint64_t const max_overflow = store->max_overflow;
+    uint64_t nbr_overflow = 0;
+    uint64_t i = 0;
+    int64_t prev, next;
+    prev = clocktick_get_timevalue(&ctx);
+    for (; i < max_diffs; i++) {
+        next = clocktick_get_timevalue(&ctx);
+        int64_t const diff = next - prev;
+        prev = next;
+        // Negative diffs wrap around to large values and go to the side table
+        if ((uint64_t) diff < diff_store_overflow) {
+            diffs[i] = (uint16_t) diff;
+        } else {
+            if (nbr_overflow == max_overflow) {
+                break;
+            }
+            diffs[i] = diff_store_overflow;
+            overflow[nbr_overflow].index = i;
+            overflow[nbr_overflow].value = diff;
+            nbr_overflow++;
+        }
+    }
+    store->nbr_diffs = i;
+    store->nbr_overflow = nbr_overflow;
+    return clocktick_ok;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef DIFF_STORE_H
+#define DIFF_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Compact storage for percentile test diffs.
+//
+// Almost all diffs are a few dozen clock units, so each diff is stored as a
+// uint16_t. Diffs that do not fit (negative or diff_store_overflow and up) are
+// marked with diff_store_overflow and written to a side table of {index,
+// value} in index order. Every diff is still kept exactly, in 2 bytes instead
+// of 8 for most of them.
+//
+// Percentiles are found without sorting: diff_store_sort counts the 16 bit
+// diffs (a counting sort) and sorts only the side table.
+
+enum { diff_store_overflow = UINT16_MAX };
+
+struct diff_store_overflow_entry {
+    uint64_t index;
+    int64_t value;
+};
+
+struct diff_store {
+    uint16_t *diffs;
+    uint64_t max_diffs;
+    uint64_t nbr_diffs;
+    struct diff_store_overflow_entry *overflow;
+    uint64_t max_overflow;
+    uint64_t nbr_overflow;
+    // Set by diff_store_sort
+    uint64_t *counts;           // of each 16 bit value
+    int64_t *sorted_overflow;
+    uint64_t nbr_negative;      // negative values come first in sorted_overflow
+};
+
+int diff_store_init(struct diff_store *, uint64_t const, uint64_t const);
+void diff_store_free(struct diff_store *);
+uint64_t diff_store_bytes(struct diff_store const *);
+int64_t diff_store_get(struct diff_store const *, uint64_t const);
+int diff_store_sort(struct diff_store *);
+int64_t diff_store_value_at_rank(struct diff_store const *, uint64_t const);
+int64_t diff_store_percentile(struct diff_store const *, double const);
+int clocktick_run_percentile_test_compact(struct clocktick_context const *, struct diff_store *);
+
+#endif // DIFF_STORE_H
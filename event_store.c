@@ -0,0 +1,151 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "event_store.h"
+
+static int int_comparison(const void *i, const void *j) {
+    return (*(int64_t const*) i < *(int64_t const*) j) ? -1:1;
+}
+
+// Reserve room for at least bytes of encoded events, returns 0 on success
+int event_store_init(struct event_store *store, uint64_t const bytes) {
+    memset(store, 0, sizeof(*store));
+    uint64_t nbr_blocks = bytes / sizeof(struct event_store_block) + 1;
+    store->blocks = calloc(nbr_blocks, sizeof(struct event_store_block));
+    if (store->blocks == NULL) {
+        return -1;
+    }
+    store->nbr_blocks = nbr_blocks;
+    return 0;
+}
+
+void event_store_free(struct event_store *store) {
+    free(store->blocks);
+    memset(store, 0, sizeof(*store));
+}
+
+// Adds half of the current blocks, returns 0 on success. The blocks are
+// moved, so cursors of the store are not valid after this.
+int event_store_grow(struct event_store *store) {
+    uint64_t const nbr_blocks = store->nbr_blocks + store->nbr_blocks / 2 + 1;
+    struct event_store_block *blocks = realloc(store->blocks, nbr_blocks * sizeof(struct event_store_block));
+    if (blocks == NULL) {
+        return -1;
+    }
+    store->blocks = blocks;
+    store->nbr_blocks = nbr_blocks;
+    return 0;
+}
+
+// Encoded size of the events, including the block headers
+uint64_t event_store_bytes_used(struct event_store const *store) {
+    if (store->nbr_events == 0) {
+        return 0;
+    }
+    uint64_t bytes = 0;
+    for (uint64_t i = 0; i <= store->current_block; i++) {
+        bytes += offsetof(struct event_store_block, data) + store->blocks[i].nbr_bytes;
+    }
+    return bytes;
+}
+
+uint64_t event_store_bytes_allocated(struct event_store const *store) {
+    return store->nbr_blocks * sizeof(struct event_store_block);
+}
+
+void event_store_cursor_init(struct event_store_cursor *cursor, struct event_store const *store) {
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->store = store;
+}
+
+bool event_store_next(struct event_store_cursor *cursor, struct cumulative_test_results *result) {
+    struct event_store const *store = cursor->store;
+    if (store->nbr_events == 0) {
+        return false;
+    }
+    struct event_store_block const *block = &store->blocks[cursor->block];
+    if (cursor->event_in_block == block->nbr_events) {
+        if (cursor->block >= store->current_block) {
+            return false;
+        }
+        cursor->block++;
+        cursor->event_in_block = 0;
+        cursor->offset = 0;
+        block++;
+    }
+    if (cursor->event_in_block == 0) {
+        cursor->timestamp = block->base_timestamp;
+    }
+    uint64_t delta, diff;
+    cursor->offset += varint_decode(block->data + cursor->offset, &delta);
+    cursor->offset += varint_decode(block->data + cursor->offset, &diff);
+    cursor->timestamp += zigzag_decode(delta);
+    cursor->event_in_block++;
+    result->timestamp = cursor->timestamp;
+    result->diff = zigzag_decode(diff);
+    return true;
+}
+
+// Decode all events of one block into results, which must have room for
+// event_store_block_size/2 entries. Returns the number of decoded events.
+uint32_t event_store_decode_block(struct event_store const *store, uint64_t const block_index, struct cumulative_test_results *results) {
+    if (store->nbr_events == 0 || block_index > store->current_block) {
+        return 0;
+    }
+    struct event_store_block const *block = &store->blocks[block_index];
+    uint8_t const *in = block->data;
+    int64_t timestamp = block->base_timestamp;
+    for (uint32_t i = 0; i < block->nbr_events; i++) {
+        uint64_t delta, diff;
+        in += varint_decode(in, &delta);
+        in += varint_decode(in, &diff);
+        timestamp += zigzag_decode(delta);
+        results[i].timestamp = timestamp;
+        results[i].diff = zigzag_decode(diff);
+    }
+    return block->nbr_events;
+}
+
+// Same as find_highest_values, but decodes the events from a compact store
+void find_highest_values_in_event_store(struct event_store const *store, int64_t *highest_values, unsigned int const nbr_highest_values) {
+    struct event_store_cursor cursor;
+    struct cumulative_test_results event;
+    event_store_cursor_init(&cursor, store);
+    while (event_store_next(&cursor, &event)) {
+        if (event.diff > highest_values[0]) {
+            highest_values[0] = event.diff;
+            qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+        }
+    }
+    qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+}
+
+// Same as find_highest_cumulative_values, time_interval must be in the units of the stored timestamps
+void find_highest_cumulative_values_in_event_store(struct event_store const *store, int64_t *highest_values, unsigned int const nbr_highest_values, int64_t time_interval) {
+    struct event_store_cursor cursor;
+    struct cumulative_test_results event;
+    event_store_cursor_init(&cursor, store);
+    if (!event_store_next(&cursor, &event)) {
+        return;
+    }
+    int64_t start = event.timestamp;
+    int64_t sum = 0;
+    do {
+        sum += event.diff;
+        if (event.timestamp >= start + time_interval) {
+            start = event.timestamp;
+            if (sum > highest_values[0]) {
+                highest_values[0] = sum;
+                qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+            }
+            sum = 0;
+        }
+    } while (event_store_next(&cursor, &event));
+    qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+}
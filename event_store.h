@@ -0,0 +1,121 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Compact storage for cumulative test events.
+//
+// Events are appended to fixed size blocks. Each block starts with the absolute
+// timestamp of its first event, and every event is stored as two LEB128 varints:
+// the zigzag encoded timestamp delta to the previous event and the zigzag encoded
+// diff. A typical jump event takes 3-5 bytes instead of the 16 bytes of
+// struct cumulative_test_results, and every block can be decoded on its own.
+
+enum {
+    event_store_block_size = 4096,
+    event_store_max_varint_bytes = 10,
+    event_store_max_event_bytes = 2 * event_store_max_varint_bytes
+};
+
+struct event_store_block {
+    int64_t base_timestamp;
+    uint32_t nbr_events;
+    uint32_t nbr_bytes;
+    uint8_t data[event_store_block_size - 16];
+};
+
+struct event_store {
+    struct event_store_block *blocks;
+    uint64_t nbr_blocks;
+    uint64_t current_block;
+    uint64_t nbr_events;
+    int64_t prev_timestamp;
+};
+
+struct event_store_cursor {
+    struct event_store const *store;
+    uint64_t block;
+    uint32_t event_in_block;
+    uint32_t offset;
+    int64_t timestamp;
+};
+
+int event_store_init(struct event_store *, uint64_t const);
+void event_store_free(struct event_store *);
+int event_store_grow(struct event_store *);
+uint64_t event_store_bytes_used(struct event_store const *);
+uint64_t event_store_bytes_allocated(struct event_store const *);
+void event_store_cursor_init(struct event_store_cursor *, struct event_store const *);
+bool event_store_next(struct event_store_cursor *, struct cumulative_test_results *);
+uint32_t event_store_decode_block(struct event_store const *, uint64_t const, struct cumulative_test_results *);
+void find_highest_values_in_event_store(struct event_store const *, int64_t *, unsigned int const);
+void find_highest_cumulative_values_in_event_store(struct event_store const *, int64_t *, unsigned int const, int64_t);
+
+static inline uint64_t zigzag_encode(int64_t const v) {
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t const v) {
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static inline uint32_t varint_encode(uint64_t v, uint8_t *out) {
+    uint32_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t) v;
+    return n;
+}
+
+static inline uint32_t varint_decode(uint8_t const *in, uint64_t *v) {
+    uint64_t result = in[0] & 0x7f;
+    uint32_t n = 1;
+    if (in[0] & 0x80) {
+        unsigned int shift = 7;
+        do {
+            result |= (uint64_t) (in[n] & 0x7f) << shift;
+            shift += 7;
+        } while (in[n++] & 0x80);
+    }
+    *v = result;
+    return n;
+}
+
+// Called from the measurement loop, so this is kept inline and allocation free.
+// Returns false when the store is full, see event_store_grow.
+static inline bool event_store_append(struct event_store *store, int64_t const timestamp, int64_t const diff) {
+    struct event_store_block *block = &store->blocks[store->current_block];
+    if (block->nbr_bytes + event_store_max_event_bytes > sizeof(block->data)) {
+        if (store->current_block + 1 >= store->nbr_blocks) {
+            return false;
+        }
+        store->current_block++;
+        block++;
+        block->nbr_events = 0;
+        block->nbr_bytes = 0;
+    }
+    if (block->nbr_events == 0) {
+        block->base_timestamp = timestamp;
+        store->prev_timestamp = timestamp;
+    }
+    uint8_t *out = block->data + block->nbr_bytes;
+    uint32_t n = varint_encode(zigzag_encode(timestamp - store->prev_timestamp), out);
+    n += varint_encode(zigzag_encode(diff), out + n);
+    block->nbr_bytes += n;
+    block->nbr_events++;
+    store->prev_timestamp = timestamp;
+    store->nbr_events++;
+    return true;
+}
+
+#endif // EVENT_STORE_H
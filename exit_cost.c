@@ -0,0 +1,83 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <cpuid.h>
+#include <immintrin.h>
+#include <sys/syscall.h>
+#include "exit_cost.h"
+
+// pause takes about 140 cycles on Skylake and later cores, but about 10 on
+// older ones. 1024 pauses are longer than the default KVM pause-loop exiting
+// window of 4096 cycles on both.
+struct exit_cost_op const exit_cost_default_ops[] = {
+    {'n', 0, 0, "rdtsc (control)"},
+    {'c', 0x0, 0, "cpuid 0x0"},
+    {'c', 0x1, 0, "cpuid 0x1"},
+    {'c', 0x7, 0, "cpuid 0x7"},
+    {'c', 0x40000000, 0, "cpuid 0x40000000"},
+    {'p', 0, 1, "pause"},
+    {'p', 0, 1024, "pause x1024"},
+    {'s', 0, 0, "getppid"}
+};
+
+int const exit_cost_nbr_default_ops = sizeof(exit_cost_default_ops) / sizeof(exit_cost_default_ops[0]);
+
+// Each kind has a loop of its own, so that nothing but the operation is
+// between the reads
+int clocktick_run_exit_cost(struct clocktick_context const *ctx, struct exit_cost_op const *op, int64_t *results, uint64_t const number_of_iterations) {
+    // Timed with rdtsc, since rdtscp would add a cpuid to every result
+    if (ctx->clocktype != 't' && ctx->clocktype != 'p') {
+        return clocktick_error_clocktype;
+    }
+    if (!ctx->cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    uint32_t const leaf = op->leaf;
+    uint32_t const repeat = op->repeat;
+    int64_t start;
+    switch (op->kind) {
+    case 'n':
+        for (uint64_t i = 0; i < number_of_iterations; i++) {
+            start = get_tsc_with_rdtsc();
+            results[i] = get_tsc_with_rdtsc() - start;
+        }
+        break;
+    case 'c':
+        for (uint64_t i = 0; i < number_of_iterations; i++) {
+            start = get_tsc_with_rdtsc();
+            __cpuid_count(leaf, 0, eax, ebx, ecx, edx);
+            results[i] = get_tsc_with_rdtsc() - start;
+        }
+        // Keep the compiler from dropping cpuid
+        __asm__ volatile ("" : : "r"(eax), "r"(ebx), "r"(ecx), "r"(edx));
+        break;
+    case 'p':
+        if (repeat == 0) {
+            return clocktick_error_argument;
+        }
+        for (uint64_t i = 0; i < number_of_iterations; i++) {
+            start = get_tsc_with_rdtsc();
+            for (uint32_t j = 0; j < repeat; j++) {
+                _mm_pause();
+            }
+            results[i] = get_tsc_with_rdtsc() - start;
+        }
+        break;
+    case 's':
+        for (uint64_t i = 0; i < number_of_iterations; i++) {
+            start = get_tsc_with_rdtsc();
+            syscall(SYS_getppid);
+            results[i] = get_tsc_with_rdtsc() - start;
+        }
+        break;
+    default:
+        return clocktick_error_argument;
+    }
+    return clocktick_ok;
+}
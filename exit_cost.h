@@ -0,0 +1,36 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef EXIT_COST_H
+#define EXIT_COST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Exit cost test: times instructions that make a virtual machine exit to the
+// hypervisor, each one between two rdtsc reads. cpuid always exits under KVM
+// (and it is part of every rdtscp read of this tool), a long run of pause
+// exits when pause-loop exiting is on, and a cheap system call shows the cost
+// of entering the kernel for comparison. The control is two rdtsc reads with
+// nothing between them. On bare metal the same operations give the native
+// costs, so comparing the results gives the overhead of the hypervisor.
+
+// kind is 'n' for nothing (the control), 'c' for cpuid with the given leaf,
+// 'p' for repeat pause instructions and 's' for the getppid system call
+struct exit_cost_op {
+    char kind;
+    uint32_t leaf;
+    uint32_t repeat;
+    char const *name;
+};
+
+extern struct exit_cost_op const exit_cost_default_ops[];
+extern int const exit_cost_nbr_default_ops;
+
+int clocktick_run_exit_cost(struct clocktick_context const *, struct exit_cost_op const *, int64_t *, uint64_t const);
+
+#endif // EXIT_COST_H
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "flight_recorder.h"
+
+static char const *const tracefs_paths[] = {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"};
+
+// First character of a tracefs file, '\0' on errors
+static char read_setting(struct flight_recorder const *fr, char const *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", fr->tracefs, name);
+    int fd = open(path, O_RDONLY);
+    char c = '\0';
+    if (fd >= 0) {
+        if (read(fd, &c, 1) != 1) {
+            c = '\0';
+        }
+        close(fd);
+    }
+    return c;
+}
+
+static int write_setting(struct flight_recorder const *fr, char const *name, char const value) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", fr->tracefs, name);
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    if (fd < 0) {
+        return clocktick_error_system;
+    }
+    char const line[2] = {value, '\n'};
+    int const status = (write(fd, line, sizeof(line)) == sizeof(line)) ? clocktick_ok : clocktick_error_system;
+    close(fd);
+    return status;
+}
+
+// tracefs is the tracefs directory, NULL finds the mounted one. Times in the
+// markers are converted to ns with ctx.
+int flight_recorder_open(struct flight_recorder *fr, struct clocktick_context const *ctx, char const *tracefs, uint64_t const max_hits) {
+    memset(fr, 0, sizeof(*fr));
+    fr->marker_fd = -1;
+    if (!clocktick_units_in_ns(ctx) && !ctx->cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    fr->ctx = *ctx;
+    fr->max_hits = max_hits;
+    for (unsigned int i = 0; i < sizeof(tracefs_paths) / sizeof(tracefs_paths[0]) && tracefs == NULL; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/trace_marker", tracefs_paths[i]);
+        if (access(path, W_OK) == 0) {
+            tracefs = tracefs_paths[i];
+        }
+    }
+    if (tracefs == NULL) {
+        return clocktick_error_system;
+    }
+    snprintf(fr->tracefs, sizeof(fr->tracefs), "%s", tracefs);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/trace_marker", fr->tracefs);
+    fr->marker_fd = open(path, O_WRONLY);
+    fr->tracing_on_was = read_setting(fr, "tracing_on");
+    fr->overwrite_was = read_setting(fr, "options/overwrite");
+    if (fr->marker_fd < 0 || write_setting(fr, "options/overwrite", '1') < 0 || write_setting(fr, "tracing_on", '1') < 0) {
+        flight_recorder_close(fr);
+        return clocktick_error_system;
+    }
+    return clocktick_ok;
+}
+
+// Callback of struct clocktick_jump_hook, arg is the flight recorder
+void flight_recorder_mark(int64_t const start, int64_t const diff, void *arg) {
+    struct flight_recorder *fr = arg;
+    if (fr->stopped) {
+        return;
+    }
+    fr->nbr_hits++;
+    char line[128];
+    int const n = snprintf(line, sizeof(line), "clocktick_jumps: jump %" PRIu64 " of %" PRId64 " ns, started %" PRId64 " ns before this marker\n", \
+        fr->nbr_hits, clocktick_to_ns(&fr->ctx, diff), clocktick_to_ns(&fr->ctx, clocktick_get_timevalue(&fr->ctx) - start));
+    if (write(fr->marker_fd, line, n) != n) {
+        return;
+    }
+    if (fr->max_hits != 0 && fr->nbr_hits >= fr->max_hits) {
+        write_setting(fr, "tracing_on", '0');
+        fr->stopped = true;
+    }
+}
+
+// Stops tracing and copies the trace buffer to path
+int flight_recorder_save(struct flight_recorder *fr, char const *path) {
+    write_setting(fr, "tracing_on", '0');
+    fr->stopped = true;
+    char trace_path[512];
+    snprintf(trace_path, sizeof(trace_path), "%s/trace", fr->tracefs);
+    FILE *in = fopen(trace_path, "r");
+    if (in == NULL) {
+        return clocktick_error_system;
+    }
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fclose(in);
+        return clocktick_error_system;
+    }
+    char buffer[65536];
+    size_t n;
+    int status = clocktick_ok;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            status = clocktick_error_system;
+            break;
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0) {
+        status = clocktick_error_system;
+    }
+    return status;
+}
+
+void flight_recorder_close(struct flight_recorder *fr) {
+    if (fr->marker_fd >= 0) {
+        close(fr->marker_fd);
+        fr->marker_fd = -1;
+    }
+    if (fr->overwrite_was != '\0') {
+        write_setting(fr, "options/overwrite", fr->overwrite_was);
+    }
+    if (fr->tracing_on_was != '\0') {
+        write_setting(fr, "tracing_on", fr->tracing_on_was);
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Kernel flight recorder: keeps the ftrace ring buffer running in overwrite
+// mode while a test runs, and writes a trace_marker entry for every large
+// jump (see struct clocktick_jump_hook), so that the trace shows what the
+// kernel was doing at the jump. Tracing can be stopped after max_hits jumps,
+// so that later events do not overwrite the interesting part of the buffer.
+// The trace events themselves are chosen as usual, e.g. in
+// tracefs/set_event. The settings changed here are restored when closing.
+
+struct flight_recorder {
+    struct clocktick_context ctx;
+    char tracefs[256];
+    int marker_fd;
+    uint64_t max_hits;          // 0 never stops tracing
+    uint64_t nbr_hits;
+    bool stopped;
+    char tracing_on_was;
+    char overwrite_was;
+};
+
+int flight_recorder_open(struct flight_recorder *, struct clocktick_context const *, char const *, uint64_t const);
+void flight_recorder_mark(int64_t const, int64_t const, void *);
+int flight_recorder_save(struct flight_recorder *, char const *);
+void flight_recorder_close(struct flight_recorder *);
+
+#endif // FLIGHT_RECORDER_H
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "handoff_test.h"
+
+char const *handoff_class_names[nbr_handoff_classes] = {"smt", "llc", "socket", "remote"};
+
+// The bounced value has a cache line of its own
+struct handoff_line {
+    _Alignas(64) uint64_t sequence;
+    char padding[64 - sizeof(uint64_t)];
+};
+
+struct handoff_pair {
+    pthread_t threads[2];
+    pthread_barrier_t barrier;
+    int cpus[2];
+    int errors[2];
+    struct handoff_line *line;
+    int64_t *results;
+    uint64_t nbr_results;
+};
+
+// Reads an integer from the topology of cpu, -1 if it is not available
+static int read_cpu_value(int const cpu, char const *name) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    int value = -1;
+    if (fscanf(f, "%d", &value) != 1) {
+        value = -1;
+    }
+    fclose(f);
+    return value;
+}
+
+enum handoff_pair_class handoff_get_pair_class(int const cpu_a, int const cpu_b) {
+    int const package = read_cpu_value(cpu_a, "topology/physical_package_id");
+    if (package != read_cpu_value(cpu_b, "topology/physical_package_id")) {
+        return handoff_class_remote;
+    }
+    if (read_cpu_value(cpu_a, "topology/core_id") == read_cpu_value(cpu_b, "topology/core_id")) {
+        return handoff_class_smt;
+    }
+    int const llc = read_cpu_value(cpu_a, "cache/index3/id");
+    if (llc >= 0 && llc == read_cpu_value(cpu_b, "cache/index3/id")) {
+        return handoff_class_llc;
+    }
+    return handoff_class_socket;
+}
+
+// Pairs of indices (circle method) for round 0 .. n - 2 (n - 1 for odd n) of
+// n CPUs. Over all rounds, every pair is returned once. Returns the number of
+// pairs of the round.
+int handoff_round_pairs(int const n, int const round, int (*pairs)[2]) {
+    int const m = n + (n % 2);     // an odd n gets a dummy that sits out
+    int nbr_pairs = 0;
+    for (int i = 0; i < m / 2; i++) {
+        // Position 0 stays, the others rotate by one each round
+        int const a = (i == 0) ? 0 : 1 + (i - 1 + round) % (m - 1);
+        int const b = 1 + (m - 2 - i + round) % (m - 1);
+        if (a < n && b < n) {
+            pairs[nbr_pairs][0] = a;
+            pairs[nbr_pairs][1] = b;
+            nbr_pairs++;
+        }
+    }
+    return nbr_pairs;
+}
+
+static inline int64_t round_trip(struct handoff_line *line, uint64_t const request) {
+    int64_t const start = get_tsc_with_rdtsc();
+    __atomic_store_n(&line->sequence, request, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&line->sequence, __ATOMIC_ACQUIRE) != request + 1) {
+    }
+    return get_tsc_with_rdtsc() - start;
+}
+
+static void *handoff_thread(void *arg, int const role) {
+    struct handoff_pair *p = arg;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(p->cpus[role], &set);
+    p->errors[role] = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+    if (role == 0) {
+        // Page in the results on the initiator before the test
+        memset(p->results, 0, p->nbr_results * sizeof(int64_t));
+    }
+    pthread_barrier_wait(&p->barrier);
+    if (p->errors[0] != 0 || p->errors[1] != 0) {
+        return NULL;
+    }
+    struct handoff_line *const line = p->line;
+    uint64_t const n = handoff_warmup_round_trips + p->nbr_results;
+    if (role == 1) {
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t const request = 2 * i + 1;
+            while (__atomic_load_n(&line->sequence, __ATOMIC_ACQUIRE) != request) {
+            }
+            __atomic_store_n(&line->sequence, request + 1, __ATOMIC_RELEASE);
+        }
+        return NULL;
+    }
+    uint64_t i = 0;
+    for (; i < handoff_warmup_round_trips; i++) {
+        round_trip(line, 2 * i + 1);
+    }
+    int64_t *const results = p->results;
+    for (uint64_t j = 0; j < p->nbr_results; i++, j++) {
+        results[j] = round_trip(line, 2 * i + 1);
+    }
+    return NULL;
+}
+
+static void *handoff_initiator(void *arg) {
+    return handoff_thread(arg, 0);
+}
+
+static void *handoff_responder(void *arg) {
+    return handoff_thread(arg, 1);
+}
+
+static int start_pair(struct handoff_pair *p) {
+    pthread_barrier_init(&p->barrier, NULL, 2);
+    if (pthread_create(&p->threads[0], NULL, &handoff_initiator, p) != 0) {
+        pthread_barrier_destroy(&p->barrier);
+        return clocktick_error_system;
+    }
+    if (pthread_create(&p->threads[1], NULL, &handoff_responder, p) != 0) {
+        // The initiator waits at the barrier for its partner
+        p->errors[1] = -1;
+        pthread_barrier_wait(&p->barrier);
+        pthread_join(p->threads[0], NULL);
+        pthread_barrier_destroy(&p->barrier);
+        return clocktick_error_system;
+    }
+    return clocktick_ok;
+}
+
+static int join_pair(struct handoff_pair *p) {
+    pthread_join(p->threads[0], NULL);
+    pthread_join(p->threads[1], NULL);
+    pthread_barrier_destroy(&p->barrier);
+    return (p->errors[0] != 0 || p->errors[1] != 0) ? clocktick_error_system : clocktick_ok;
+}
+
+static int check_handoff_clock(struct clocktick_context const *ctx) {
+    // Round trips are timed with rdtsc, so the results are in TSC cycles
+    if (ctx->clocktype != 't' && ctx->clocktype != 'p') {
+        return clocktick_error_clocktype;
+    }
+    return ctx->cyc2ns_multiplier_initialized ? clocktick_ok : clocktick_error_not_calibrated;
+}
+
+// Writes the round trip times between cpu_a and cpu_b to results
+int clocktick_run_handoff_test(struct clocktick_context const *ctx, int const cpu_a, int const cpu_b, int64_t *results, uint64_t const number_of_round_trips) {
+    int status = check_handoff_clock(ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (cpu_a < 0 || cpu_b < 0 || cpu_a == cpu_b || number_of_round_trips == 0) {
+        return clocktick_error_argument;
+    }
+    struct handoff_line *line = aligned_alloc(sizeof(struct handoff_line), sizeof(struct handoff_line));
+    if (line == NULL) {
+        return clocktick_error_system;
+    }
+    line->sequence = 0;
+    struct handoff_pair pair = {.cpus = {cpu_a, cpu_b}, .line = line, .results = results, .nbr_results = number_of_round_trips};
+    status = start_pair(&pair);
+    if (status == clocktick_ok) {
+        status = join_pair(&pair);
+    }
+    free(line);
+    return status;
+}
+
+static int int_comparison(const void *i, const void *j) {
+    int64_t const a = *(int64_t const *) i, b = *(int64_t const *) j;
+    return (a < b) ? -1 : (a > b);
+}
+
+// Measures matrix->round_trips round trips for every pair of matrix->cpus
+int clocktick_run_handoff_matrix(struct clocktick_context const *ctx, struct handoff_matrix *matrix) {
+    int status = check_handoff_clock(ctx);
+    if (status < 0) {
+        return status;
+    }
+    int const n = matrix->nbr_cpus;
+    if (n < 2 || n > max_handoff_cpus || matrix->round_trips == 0 || matrix->median == NULL || matrix->p99 == NULL) {
+        return clocktick_error_argument;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < i; j++) {
+            if (matrix->cpus[i] == matrix->cpus[j]) {
+                return clocktick_error_argument;
+            }
+        }
+    }
+    int const max_pairs = n / 2;
+    struct handoff_pair *pairs = calloc(max_pairs, sizeof(struct handoff_pair));
+    struct handoff_line *lines = aligned_alloc(sizeof(struct handoff_line), max_pairs * sizeof(struct handoff_line));
+    int64_t *results = malloc(max_pairs * matrix->round_trips * sizeof(int64_t));
+    int (*indices)[2] = malloc(max_pairs * sizeof(*indices));
+    if (pairs == NULL || lines == NULL || results == NULL || indices == NULL) {
+        status = clocktick_error_system;
+    }
+    memset(matrix->median, 0, n * n * sizeof(int64_t));
+    memset(matrix->p99, 0, n * n * sizeof(int64_t));
+
+    int const nbr_rounds = (status < 0) ? 0 : n - 1 + (n % 2);
+    for (int round = 0; round < nbr_rounds && status == clocktick_ok; round++) {
+        int const nbr_pairs = handoff_round_pairs(n, round, indices);
+        int nbr_started = 0;
+        for (int k = 0; k < nbr_pairs; k++) {
+            struct handoff_pair *p = &pairs[k];
+            memset(p, 0, sizeof(*p));
+            p->cpus[0] = matrix->cpus[indices[k][0]];
+            p->cpus[1] = matrix->cpus[indices[k][1]];
+            p->line = &lines[k];
+            p->line->sequence = 0;
+            p->results = &results[k * matrix->round_trips];
+            p->nbr_results = matrix->round_trips;
+            status = start_pair(p);
+            if (status < 0) {
+                break;
+            }
+            nbr_started++;
+        }
+        for (int k = 0; k < nbr_started; k++) {
+            int const pair_status = join_pair(&pairs[k]);
+            status = (status < 0) ? status : pair_status;
+        }
+        if (status < 0) {
+            break;
+        }
+        for (int k = 0; k < nbr_pairs; k++) {
+            int64_t *r = pairs[k].results;
+            uint64_t const m = pairs[k].nbr_results;
+            qsort(r, m, sizeof(int64_t), &int_comparison);
+            int const a = indices[k][0], b = indices[k][1];
+            matrix->median[a * n + b] = matrix->median[b * n + a] = r[m / 2];
+            matrix->p99[a * n + b] = matrix->p99[b * n + a] = r[(uint64_t) ((double) m * 0.99)];
+        }
+    }
+    free(pairs);
+    free(lines);
+    free(results);
+    free(indices);
+    return status;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef HANDOFF_TEST_H
+#define HANDOFF_TEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Handoff test: two threads pinned to a pair of CPUs bounce a cache line
+// between them, and the initiator times each round trip (two handoffs) with
+// rdtsc. This is the latency of handing a message between pinned threads,
+// which depends on whether the CPUs share a core (SMT), a last level cache or
+// a socket. The threads spin without pause, so the CPUs of a pair must differ.
+//
+// The matrix test measures all pairs of a list of CPUs. The pairs are
+// scheduled in rounds where every CPU is in at most one pair (round-robin
+// tournament), and the pairs of a round run in parallel.
+
+enum {
+    handoff_warmup_round_trips = 1000,
+    max_handoff_cpus = 64
+};
+
+enum handoff_pair_class {
+    handoff_class_smt,          // same core
+    handoff_class_llc,          // same last level cache
+    handoff_class_socket,       // same package
+    handoff_class_remote,
+    nbr_handoff_classes
+};
+
+extern char const *handoff_class_names[nbr_handoff_classes];
+
+// Results are in TSC cycles. median and p99 have nbr_cpus * nbr_cpus values,
+// the value for cpus[i] and cpus[j] is at i * nbr_cpus + j (0 on the diagonal).
+struct handoff_matrix {
+    int cpus[max_handoff_cpus];
+    int nbr_cpus;
+    uint64_t round_trips;
+    int64_t *median;
+    int64_t *p99;
+};
+
+enum handoff_pair_class handoff_get_pair_class(int const, int const);
+int handoff_round_pairs(int const, int const, int (*)[2]);
+int clocktick_run_handoff_test(struct clocktick_context const *, int const, int const, int64_t *, uint64_t const);
+int clocktick_run_handoff_matrix(struct clocktick_context const *, struct handoff_matrix *);
+
+#endif // HANDOFF_TEST_H
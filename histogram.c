@@ -0,0 +1,71 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <string.h>
+#include "histogram.h"
+
+void histogram_init(struct histogram *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void histogram_merge(struct histogram *h, struct histogram const *other) {
+    if (other->count == 0) {
+        return;
+    }
+    if (h->count == 0 || other->min < h->min) {
+        h->min = other->min;
+    }
+    if (h->count == 0 || other->max > h->max) {
+        h->max = other->max;
+    }
+    h->count += other->count;
+    for (unsigned int i = 0; i < histogram_nbr_buckets; i++) {
+        h->buckets[i] += other->buckets[i];
+    }
+}
+
+int64_t histogram_bucket_lowest(unsigned int const bucket) {
+    if (bucket < 2 * histogram_sub_buckets) {
+        return bucket;
+    }
+    unsigned int const shift = bucket / histogram_sub_buckets - 1;
+    return (int64_t) ((uint64_t) (bucket % histogram_sub_buckets + histogram_sub_buckets) << shift);
+}
+
+int64_t histogram_bucket_highest(unsigned int const bucket) {
+    if (bucket + 1 == histogram_nbr_buckets) {
+        return INT64_MAX;
+    }
+    return histogram_bucket_lowest(bucket + 1) - 1;
+}
+
+// Same definition as the percentile test, which takes the value at index
+// (int) (count * p) of the sorted values. Returns the highest value of the
+// bucket, limited by the largest value seen.
+int64_t histogram_percentile(struct histogram const *h, double const p) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t index = (uint64_t) ((double) h->count * p);
+    if (index >= h->count) {
+        index = h->count - 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < histogram_nbr_buckets; i++) {
+        seen += h->buckets[i];
+        if (seen > index) {
+            int64_t highest = histogram_bucket_highest(i);
+            return (highest < h->max) ? highest : h->max;
+        }
+    }
+    return h->max;
+}
+
+void histogram_add_values(struct histogram *h, int64_t const *values, uint64_t const n) {
+    for (uint64_t i = 0; i < n; i++) {
+        histogram_add(h, values[i]);
+    }
+}
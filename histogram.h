@@ -0,0 +1,59 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Log-linear histogram of non-negative values, for runs where storing every
+// value is too expensive. Values below histogram_sub_buckets are counted
+// exactly, larger values go to one of histogram_sub_buckets buckets per power
+// of two, so a bucket is at most 1/64 (1.6%) of its values wide. Histograms
+// with the same layout can be merged by adding the buckets.
+
+enum {
+    histogram_sub_bucket_bits = 6,
+    histogram_sub_buckets = 1 << histogram_sub_bucket_bits,
+    histogram_nbr_buckets = (64 - histogram_sub_bucket_bits) * histogram_sub_buckets
+};
+
+struct histogram {
+    uint64_t count;
+    int64_t min;
+    int64_t max;
+    uint64_t buckets[histogram_nbr_buckets];
+};
+
+void histogram_init(struct histogram *);
+void histogram_merge(struct histogram *, struct histogram const *);
+int64_t histogram_bucket_lowest(unsigned int const);
+int64_t histogram_bucket_highest(unsigned int const);
+int64_t histogram_percentile(struct histogram const *, double const);
+void histogram_add_values(struct histogram *, int64_t const *, uint64_t const);
+
+static inline unsigned int histogram_bucket(int64_t const value) {
+    if (value < histogram_sub_buckets) {
+        return (value < 0) ? 0 : (unsigned int) value;
+    }
+    unsigned int const shift = 63 - __builtin_clzll((uint64_t) value) - histogram_sub_bucket_bits;
+    return (shift + 1) * histogram_sub_buckets + (unsigned int) ((uint64_t) value >> shift) - histogram_sub_buckets;
+}
+
+// Negative values are counted as 0
+static inline void histogram_add(struct histogram *h, int64_t const value) {
+    h->buckets[histogram_bucket(value)]++;
+    if (h->count == 0 || value < h->min) {
+        h->min = value;
+    }
+    if (h->count == 0 || value > h->max) {
+        h->max = value;
+    }
+    h->count++;
+}
+
+#endif // HISTOGRAM_H
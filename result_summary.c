@@ -0,0 +1,291 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <sys/utsname.h>
+#include "result_summary.h"
+#include "calibration_cache.h"
+
+void result_summary_init(struct result_summary *s) {
+    memset(s, 0, sizeof(*s));
+    s->top_complete = true;
+}
+
+// Keys are one word, values end at the end of the line
+int result_summary_set_label(struct result_summary *s, char const *key, char const *value) {
+    size_t const key_length = strlen(key);
+    if (key_length == 0 || key_length >= sizeof(s->labels[0].key) || strpbrk(key, " \t\n=") != NULL) {
+        return clocktick_error_argument;
+    }
+    int i = 0;
+    while (i < s->nbr_labels && strcmp(s->labels[i].key, key) != 0) {
+        i++;
+    }
+    if (i == result_summary_max_labels) {
+        return clocktick_error_argument;
+    }
+    if (i == s->nbr_labels) {
+        memcpy(s->labels[i].key, key, key_length + 1);
+        s->nbr_labels++;
+    }
+    size_t n = strcspn(value, "\n");
+    if (n >= sizeof(s->labels[i].value)) {
+        n = sizeof(s->labels[i].value) - 1;
+    }
+    memcpy(s->labels[i].value, value, n);
+    s->labels[i].value[n] = '\0';
+    return clocktick_ok;
+}
+
+// NULL if there is no such label
+char const *result_summary_get_label(struct result_summary const *s, char const *key) {
+    for (int i = 0; i < s->nbr_labels; i++) {
+        if (strcmp(s->labels[i].key, key) == 0) {
+            return s->labels[i].value;
+        }
+    }
+    return NULL;
+}
+
+// Hypervisor vendor from the cpuid hypervisor leaf, "none" on bare metal
+static void read_hypervisor(char *name, size_t const size) {
+    unsigned int eax, ebx, ecx, edx;
+    snprintf(name, size, "none");
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 31))) {
+        return;
+    }
+    char signature[13] = {0};
+    __cpuid(0x40000000, eax, ebx, ecx, edx);
+    memcpy(signature, &ebx, 4);
+    memcpy(signature + 4, &ecx, 4);
+    memcpy(signature + 8, &edx, 4);
+    static char const *const vendors[][2] = {
+        {"KVMKVMKVM", "kvm"}, {"Microsoft Hv", "hyperv"}, {"VMwareVMware", "vmware"},
+        {"XenVMMXenVMM", "xen"}, {"TCGTCGTCGTCG", "qemu"}, {"ACRNACRNACRN", "acrn"}
+    };
+    for (unsigned int i = 0; i < sizeof(vendors) / sizeof(vendors[0]); i++) {
+        if (strcmp(signature, vendors[i][0]) == 0) {
+            snprintf(name, size, "%s", vendors[i][1]);
+            return;
+        }
+    }
+    snprintf(name, size, "%s", signature);
+}
+
+// Labels host, kernel, cpu_model, clocksource and hypervisor
+int result_summary_add_system_labels(struct result_summary *s) {
+    char value[256];
+    int status = clocktick_ok;
+    if (gethostname(value, sizeof(value)) == 0) {
+        value[sizeof(value) - 1] = '\0';
+        status = (status < 0) ? status : result_summary_set_label(s, "host", value);
+    }
+    struct utsname u;
+    if (uname(&u) == 0) {
+        status = (status < 0) ? status : result_summary_set_label(s, "kernel", u.release);
+    }
+    struct calibration_key key;
+    calibration_get_key(&key);
+    status = (status < 0) ? status : result_summary_set_label(s, "cpu_model", key.cpu_model);
+    status = (status < 0) ? status : result_summary_set_label(s, "clocksource", key.clocksource);
+    read_hypervisor(value, sizeof(value));
+    status = (status < 0) ? status : result_summary_set_label(s, "hypervisor", value);
+    return status;
+}
+
+static void insert_top(struct result_summary *s, int64_t const value) {
+    if (s->nbr_top == result_summary_max_top && value <= s->top[result_summary_max_top - 1]) {
+        return;
+    }
+    int i = (s->nbr_top < result_summary_max_top) ? s->nbr_top++ : result_summary_max_top - 1;
+    while (i > 0 && s->top[i - 1] < value) {
+        s->top[i] = s->top[i - 1];
+        i--;
+    }
+    s->top[i] = value;
+}
+
+// Adds a value to the largest values only, for tests that do not keep the
+// other values
+void result_summary_add_top(struct result_summary *s, int64_t const value) {
+    s->top_complete = false;
+    insert_top(s, value);
+}
+
+void result_summary_add_values(struct result_summary *s, int64_t const *values, uint64_t const n) {
+    for (uint64_t i = 0; i < n; i++) {
+        histogram_add(&s->histogram, values[i]);
+        insert_top(s, values[i]);
+    }
+}
+
+// Labels that differ between the summaries get the value "*". Summaries of
+// different tests are not merged, and give clocktick_error_argument.
+int result_summary_merge(struct result_summary *s, struct result_summary const *other) {
+    char const *test = result_summary_get_label(s, "test");
+    char const *other_test = result_summary_get_label(other, "test");
+    if ((test == NULL) != (other_test == NULL) || (test != NULL && strcmp(test, other_test) != 0)) {
+        return clocktick_error_argument;
+    }
+    for (int i = 0; i < s->nbr_labels; i++) {
+        char const *value = result_summary_get_label(other, s->labels[i].key);
+        if (value == NULL || strcmp(value, s->labels[i].value) != 0) {
+            strcpy(s->labels[i].value, "*");
+        }
+    }
+    for (int i = 0; i < other->nbr_labels; i++) {
+        if (result_summary_get_label(s, other->labels[i].key) == NULL) {
+            result_summary_set_label(s, other->labels[i].key, "*");
+        }
+    }
+    histogram_merge(&s->histogram, &other->histogram);
+
+    int64_t top[result_summary_max_top];
+    int i = 0, j = 0, n = 0;
+    while (n < result_summary_max_top && (i < s->nbr_top || j < other->nbr_top)) {
+        if (j == other->nbr_top || (i < s->nbr_top && s->top[i] >= other->top[j])) {
+            top[n++] = s->top[i++];
+        } else {
+            top[n++] = other->top[j++];
+        }
+    }
+    memcpy(s->top, top, n * sizeof(int64_t));
+    s->nbr_top = n;
+    s->top_complete = s->top_complete && other->top_complete;
+    return clocktick_ok;
+}
+
+// Same definition as histogram_percentile, but exact for the percentiles
+// that fall within the largest values, when those are counted in the histogram
+int64_t result_summary_percentile(struct result_summary const *s, double const p) {
+    struct histogram const *h = &s->histogram;
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t index = (uint64_t) ((double) h->count * p);
+    if (index >= h->count) {
+        index = h->count - 1;
+    }
+    uint64_t const rank = h->count - 1 - index;
+    if (s->top_complete && rank < (uint64_t) s->nbr_top) {
+        return s->top[rank];
+    }
+    return histogram_percentile(h, p);
+}
+
+// Writes a new file and renames it over the old one, so that cj_merge never
+// sees a partial summary
+int result_summary_save(struct result_summary const *s, char const *path) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int) getpid());
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        return clocktick_error_system;
+    }
+    fprintf(f, "clocktick_summary %d\n", result_summary_version);
+    for (int i = 0; i < s->nbr_labels; i++) {
+        fprintf(f, "label %s %s\n", s->labels[i].key, s->labels[i].value);
+    }
+    fprintf(f, "count %" PRIu64 "\nmin %" PRId64 "\nmax %" PRId64 "\ntop %d", s->histogram.count, s->histogram.min, s->histogram.max, s->nbr_top);
+    for (int i = 0; i < s->nbr_top; i++) {
+        fprintf(f, " %" PRId64, s->top[i]);
+    }
+    fprintf(f, "\ntop_complete %d\n", s->top_complete ? 1 : 0);
+    for (unsigned int i = 0; i < histogram_nbr_buckets; i++) {
+        if (s->histogram.buckets[i] != 0) {
+            fprintf(f, "bucket %u %" PRIu64 "\n", i, s->histogram.buckets[i]);
+        }
+    }
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return clocktick_error_system;
+    }
+    return clocktick_ok;
+}
+
+static int parse_top(struct result_summary *s, char const *line) {
+    char *end;
+    long const n = strtol(line, &end, 10);
+    if (n < 0 || n > result_summary_max_top) {
+        return clocktick_error_argument;
+    }
+    for (long i = 0; i < n; i++) {
+        char const *start = end;
+        s->top[i] = strtoll(start, &end, 10);
+        if (end == start || (i > 0 && s->top[i] > s->top[i - 1])) {
+            return clocktick_error_argument;
+        }
+    }
+    s->nbr_top = (int) n;
+    return clocktick_ok;
+}
+
+// Returns clocktick_error_system if the file can not be read and
+// clocktick_error_argument if it is not a valid summary
+int result_summary_load(struct result_summary *s, char const *path) {
+    result_summary_init(s);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return clocktick_error_system;
+    }
+    char line[2048];
+    int version = 0;
+    if (fgets(line, sizeof(line), f) == NULL || sscanf(line, "clocktick_summary %d", &version) != 1 || \
+        version < 1 || version > result_summary_version) {
+        fclose(f);
+        return clocktick_error_argument;
+    }
+    int status = clocktick_ok;
+    uint64_t bucket_total = 0;
+    bool have_top_complete = false;
+    while (status == clocktick_ok && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        unsigned int index;
+        uint64_t count;
+        int top_complete;
+        if (strncmp(line, "label ", 6) == 0) {
+            char *key = line + 6;
+            char *value = strchr(key, ' ');
+            if (value == NULL) {
+                status = clocktick_error_argument;
+                break;
+            }
+            *value++ = '\0';
+            status = result_summary_set_label(s, key, value);
+        } else if (strncmp(line, "top ", 4) == 0) {
+            status = parse_top(s, line + 4);
+        } else if (sscanf(line, "top_complete %d", &top_complete) == 1) {
+            s->top_complete = (top_complete != 0);
+            have_top_complete = true;
+        } else if (sscanf(line, "bucket %u %" SCNu64, &index, &count) == 2) {
+            if (index >= histogram_nbr_buckets) {
+                status = clocktick_error_argument;
+                break;
+            }
+            s->histogram.buckets[index] += count;
+            bucket_total += count;
+        } else if (sscanf(line, "count %" SCNu64, &s->histogram.count) == 1 || \
+                   sscanf(line, "min %" SCNd64, &s->histogram.min) == 1 || \
+                   sscanf(line, "max %" SCNd64, &s->histogram.max) == 1) {
+            continue;
+        }
+    }
+    fclose(f);
+    if (status == clocktick_ok && bucket_total != s->histogram.count) {
+        status = clocktick_error_argument;
+    }
+    // Version 1 files do not say, but the top values of a test that kept
+    // only those are not in the histogram
+    if (!have_top_complete) {
+        s->top_complete = (s->nbr_top == 0) || ((uint64_t) s->nbr_top <= s->histogram.count && s->top[0] == s->histogram.max);
+    }
+    return status;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef RESULT_SUMMARY_H
+#define RESULT_SUMMARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+#include "histogram.h"
+
+// Summary of a test run that can be saved to a file and merged with the
+// summaries of other runs, e.g. from many hosts. Values are in ns, so runs
+// with different clock frequencies can be merged. The histogram keeps the
+// percentiles, and the largest values are kept exactly. Merging two summaries
+// of the same test gives the same summary as one run with the values of both.
+// Labels (e.g. host, cpu_model, hypervisor) tell where the values come from.
+// Tests that keep only their largest values (e.g. the highest test) have an
+// empty histogram, and their top values are not used for percentiles.
+//
+// The file is text, one item per line:
+//   clocktick_summary 2
+//   label <key> <value to the end of the line>
+//   count <n>, min <ns>, max <ns>
+//   top <k> <largest value> ... <k:th largest value>
+//   top_complete <0 or 1>      (1 if the top values are counted in the buckets)
+//   bucket <index> <count>     (only the non-empty buckets)
+// Files of newer versions are rejected, unknown lines are ignored.
+
+enum {
+    result_summary_version = 2,
+    result_summary_max_labels = 16,
+    result_summary_max_top = 64
+};
+
+struct result_label {
+    char key[32];
+    char value[128];
+};
+
+struct result_summary {
+    struct result_label labels[result_summary_max_labels];
+    int nbr_labels;
+    struct histogram histogram;
+    int64_t top[result_summary_max_top];    // largest first
+    int nbr_top;
+    bool top_complete;          // top holds the largest values of the histogram
+};
+
+void result_summary_init(struct result_summary *);
+int result_summary_set_label(struct result_summary *, char const *, char const *);
+char const *result_summary_get_label(struct result_summary const *, char const *);
+int result_summary_add_system_labels(struct result_summary *);
+void result_summary_add_top(struct result_summary *, int64_t const);
+void result_summary_add_values(struct result_summary *, int64_t const *, uint64_t const);
+int result_summary_merge(struct result_summary *, struct result_summary const *);
+int64_t result_summary_percentile(struct result_summary const *, double const);
+int result_summary_save(struct result_summary const *, char const *);
+int result_summary_load(struct result_summary *, char const *);
+
+#endif // RESULT_SUMMARY_H
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include "sentinel.h"
+
+static int64_t get_clock_ns(clockid_t const clock) {
+    struct timespec tp;
+    clock_gettime(clock, &tp);
+    return tp.tv_nsec + s2ns(tp.tv_sec);
+}
+
+static void sleep_until(int64_t const deadline_ns) {
+    struct timespec const tp = {.tv_sec = deadline_ns / one_billion, .tv_nsec = deadline_ns % one_billion};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR) {
+    }
+}
+
+static int pin_to_cpu(int const cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+static void report(struct sentinel_report *r, struct histogram *interval, struct histogram *total, \
+                   int64_t const cpu_ns, int64_t const wall_ns, sentinel_report_callback callback, void *arg) {
+    histogram_merge(total, interval);
+    r->interval = interval;
+    r->total = total;
+    r->cpu_usage = (wall_ns > 0) ? (double) cpu_ns / (double) wall_ns : 0;
+    callback(r, arg);
+    histogram_init(interval);
+    r->index++;
+    r->nbr_bursts = 0;
+}
+
+int clocktick_run_sentinel(struct clocktick_context const *ctx, struct sentinel_config const *config, sentinel_report_callback callback, void *arg) {
+    if (config->burst_ns <= 0 || config->period_ns < config->burst_ns || config->report_interval_ns <= 0 || \
+        config->cpu_budget <= 0 || config->cpu_budget > 1 || config->nbr_cpus < 0 || config->nbr_cpus > max_correlated_cpus) {
+        return clocktick_error_argument;
+    }
+    int status = clocktick_check_clock(ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (!clocktick_units_in_ns(ctx) && !ctx->cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    int64_t *samples = malloc(sentinel_max_burst_samples * sizeof(int64_t));
+    struct histogram *interval = malloc(sizeof(struct histogram));
+    struct histogram *total = malloc(sizeof(struct histogram));
+    if (samples == NULL || interval == NULL || total == NULL) {
+        free(samples);
+        free(interval);
+        free(total);
+        return clocktick_error_system;
+    }
+    histogram_init(interval);
+    histogram_init(total);
+
+    // Start with a period that fits the budget
+    int64_t period_ns = config->period_ns;
+    if ((double) config->burst_ns > config->cpu_budget * (double) period_ns) {
+        period_ns = (int64_t) ((double) config->burst_ns / config->cpu_budget);
+    }
+    int64_t const burst = clocktick_from_ns(ctx, config->burst_ns);
+    struct sentinel_report r = {.period_ns = period_ns};
+    int64_t const start = get_clock_ns(CLOCK_MONOTONIC);
+    int64_t interval_start = start;
+    int64_t interval_cpu_start = get_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    int64_t next_burst = start;
+    int cpu_index = 0;
+
+    while (config->duration_ns == 0 || next_burst < start + config->duration_ns) {
+        if (config->nbr_cpus > 0) {
+            // Migrate before sleeping, so the move is not part of the burst.
+            // Bursts on another CPU than the listed one would be misleading.
+            if (pin_to_cpu(config->cpus[cpu_index]) != 0) {
+                status = clocktick_error_system;
+                break;
+            }
+            cpu_index = (cpu_index + 1) % config->nbr_cpus;
+        }
+        sleep_until(next_burst);
+        uint64_t nbr_samples;
+        status = clocktick_run_burst(ctx, burst, samples, sentinel_max_burst_samples, &nbr_samples);
+        if (status < 0) {
+            break;
+        }
+        histogram_add_values(interval, samples, nbr_samples);
+        r.nbr_bursts++;
+        next_burst += period_ns;
+
+        int64_t const now = get_clock_ns(CLOCK_MONOTONIC);
+        if (next_burst < now) {
+            // Do not catch up missed bursts, that would break the budget
+            next_burst = now + period_ns;
+        }
+        if (now - interval_start >= config->report_interval_ns) {
+            int64_t const cpu_now = get_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+            report(&r, interval, total, cpu_now - interval_cpu_start, now - interval_start, callback, arg);
+            // Stretch the period if the bursts and their overhead used too much
+            if (r.cpu_usage > config->cpu_budget) {
+                period_ns = (int64_t) ((double) period_ns * r.cpu_usage / config->cpu_budget);
+            } else if (period_ns > config->period_ns && r.cpu_usage < 0.5 * config->cpu_budget) {
+                period_ns = (period_ns / 2 > config->period_ns) ? period_ns / 2 : config->period_ns;
+            }
+            r.period_ns = period_ns;
+            interval_start = now;
+            interval_cpu_start = cpu_now;
+        }
+    }
+    if (status == clocktick_ok && interval->count > 0) {
+        report(&r, interval, total, get_clock_ns(CLOCK_THREAD_CPUTIME_ID) - interval_cpu_start, \
+               get_clock_ns(CLOCK_MONOTONIC) - interval_start, callback, arg);
+    }
+    free(samples);
+    free(interval);
+    free(total);
+    return status;
+}
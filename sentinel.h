@@ -0,0 +1,49 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef SENTINEL_H
+#define SENTINEL_H
+
+#include <stdint.h>
+#include "clocktick.h"
+#include "histogram.h"
+#include "correlated_test.h"
+
+// Sentinel test: low duty cycle monitoring for production hosts. Instead of
+// taking a whole core, the measurement loop runs for a short burst every
+// period, optionally on the next CPU of a list each time. The diffs of the
+// bursts are added to histograms that are reported every report interval.
+// If the thread uses more CPU time than the budget allows, the period is
+// stretched.
+
+// Diffs of one burst are stored before adding them to the histogram, so the
+// loop does the same work as the percentile test
+enum { sentinel_max_burst_samples = 16384 };
+
+struct sentinel_config {
+    int64_t burst_ns;
+    int64_t period_ns;
+    double cpu_budget;          // fraction of one CPU, e.g. 0.01
+    int64_t report_interval_ns;
+    int64_t duration_ns;        // 0 runs forever
+    int cpus[max_correlated_cpus];
+    int nbr_cpus;               // 0 stays on the current CPU
+};
+
+struct sentinel_report {
+    uint64_t index;
+    struct histogram const *interval;
+    struct histogram const *total;
+    uint64_t nbr_bursts;
+    double cpu_usage;           // fraction of one CPU during the interval
+    int64_t period_ns;          // period in use, may be stretched by the budget
+};
+
+typedef void (*sentinel_report_callback)(struct sentinel_report const *, void *);
+
+int clocktick_run_sentinel(struct clocktick_context const *, struct sentinel_config const *, sentinel_report_callback, void *);
+
+#endif // SENTINEL_H
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "series.h"
+
+// The clock is read this many times between the checks for the end of an
+// interval, so that the check does not add to every diff
+enum { series_reads_per_check = 256 };
+
+int histogram_series_init(struct histogram_series *series, int64_t const interval_ns, uint32_t const max_entries) {
+    memset(series, 0, sizeof(*series));
+    if (interval_ns <= 0 || max_entries < 2) {
+        return clocktick_error_argument;
+    }
+    series->entries = calloc(max_entries, sizeof(struct histogram_series_entry));
+    series->current = malloc(sizeof(struct histogram));
+    if (series->entries == NULL || series->current == NULL) {
+        histogram_series_free(series);
+        return clocktick_error_system;
+    }
+    series->interval_ns = interval_ns;
+    series->intervals_per_entry = 1;
+    series->max_entries = max_entries;
+    return clocktick_ok;
+}
+
+void histogram_series_free(struct histogram_series *series) {
+    for (uint32_t i = 0; i < series->nbr_entries; i++) {
+        free(series->entries[i].buckets);
+    }
+    free(series->entries);
+    free(series->current);
+    memset(series, 0, sizeof(*series));
+}
+
+static int compact_histogram(struct histogram_series_entry *entry, struct histogram const *h, int64_t const start_ns, int64_t const end_ns) {
+    uint32_t n = 0;
+    for (unsigned int i = 0; i < histogram_nbr_buckets; i++) {
+        n += (h->buckets[i] != 0);
+    }
+    entry->buckets = malloc(n * sizeof(struct histogram_series_bucket) + 1);
+    if (entry->buckets == NULL) {
+        return clocktick_error_system;
+    }
+    n = 0;
+    for (unsigned int i = 0; i < histogram_nbr_buckets; i++) {
+        if (h->buckets[i] != 0) {
+            entry->buckets[n].index = i;
+            entry->buckets[n].count = h->buckets[i];
+            n++;
+        }
+    }
+    entry->nbr_buckets = n;
+    entry->start_ns = start_ns;
+    entry->end_ns = end_ns;
+    entry->count = h->count;
+    entry->min = h->min;
+    entry->max = h->max;
+    return clocktick_ok;
+}
+
+// Same as histogram_merge for a compact entry
+static void merge_entry(struct histogram *h, struct histogram_series_entry const *entry) {
+    if (entry->count == 0) {
+        return;
+    }
+    if (h->count == 0 || entry->min < h->min) {
+        h->min = entry->min;
+    }
+    if (h->count == 0 || entry->max > h->max) {
+        h->max = entry->max;
+    }
+    h->count += entry->count;
+    for (uint32_t i = 0; i < entry->nbr_buckets; i++) {
+        h->buckets[entry->buckets[i].index] += entry->buckets[i].count;
+    }
+}
+
+// Merges b into a. The buckets of both are sorted by index.
+static int merge_entries(struct histogram_series_entry *a, struct histogram_series_entry const *b) {
+    struct histogram_series_bucket *buckets = malloc((a->nbr_buckets + b->nbr_buckets) * sizeof(struct histogram_series_bucket) + 1);
+    if (buckets == NULL) {
+        return clocktick_error_system;
+    }
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < a->nbr_buckets || j < b->nbr_buckets) {
+        if (j == b->nbr_buckets || (i < a->nbr_buckets && a->buckets[i].index < b->buckets[j].index)) {
+            buckets[n++] = a->buckets[i++];
+        } else if (i == a->nbr_buckets || b->buckets[j].index < a->buckets[i].index) {
+            buckets[n++] = b->buckets[j++];
+        } else {
+            buckets[n] = a->buckets[i++];
+            buckets[n++].count += b->buckets[j++].count;
+        }
+    }
+    free(a->buckets);
+    a->buckets = buckets;
+    a->nbr_buckets = n;
+    if (b->count > 0) {
+        if (a->count == 0 || b->min < a->min) {
+            a->min = b->min;
+        }
+        if (a->count == 0 || b->max > a->max) {
+            a->max = b->max;
+        }
+    }
+    a->count += b->count;
+    a->end_ns = b->end_ns;
+    return clocktick_ok;
+}
+
+// Merge neighbouring entries, which halves the number of entries
+static int coarsen(struct histogram_series *series) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < series->nbr_entries; i += 2) {
+        series->entries[n] = series->entries[i];
+        if (i + 1 < series->nbr_entries) {
+            int status = merge_entries(&series->entries[n], &series->entries[i + 1]);
+            if (status < 0) {
+                return status;
+            }
+            free(series->entries[i + 1].buckets);
+        }
+        n++;
+    }
+    memset(&series->entries[n], 0, (series->nbr_entries - n) * sizeof(struct histogram_series_entry));
+    series->nbr_entries = n;
+    series->intervals_per_entry *= 2;
+    return clocktick_ok;
+}
+
+// Adds the histogram of the interval from start_ns to end_ns. Intervals must
+// be added in time order.
+int histogram_series_add(struct histogram_series *series, int64_t const start_ns, int64_t const end_ns, struct histogram const *h) {
+    if (series->current_open && series->current_intervals >= series->intervals_per_entry) {
+        if (series->nbr_entries == series->max_entries) {
+            int status = coarsen(series);
+            if (status < 0) {
+                return status;
+            }
+        }
+        // After coarsening, the current entry takes more intervals
+        if (series->current_intervals >= series->intervals_per_entry) {
+            int status = compact_histogram(&series->entries[series->nbr_entries], series->current, \
+                                           series->current_start_ns, series->current_end_ns);
+            if (status < 0) {
+                return status;
+            }
+            series->nbr_entries++;
+            series->current_open = false;
+        }
+    }
+    if (!series->current_open) {
+        histogram_init(series->current);
+        series->current_intervals = 0;
+        series->current_start_ns = start_ns;
+        series->current_open = true;
+    }
+    histogram_merge(series->current, h);
+    series->current_intervals++;
+    series->current_end_ns = end_ns;
+    return clocktick_ok;
+}
+
+// Includes the entry being filled
+uint32_t histogram_series_nbr_entries(struct histogram_series const *series) {
+    return series->nbr_entries + (series->current_open ? 1 : 0);
+}
+
+void histogram_series_get(struct histogram_series const *series, uint32_t const index, struct histogram *h, int64_t *start_ns, int64_t *end_ns) {
+    histogram_init(h);
+    if (index < series->nbr_entries) {
+        merge_entry(h, &series->entries[index]);
+        *start_ns = series->entries[index].start_ns;
+        *end_ns = series->entries[index].end_ns;
+    } else {
+        histogram_merge(h, series->current);
+        *start_ns = series->current_start_ns;
+        *end_ns = series->current_end_ns;
+    }
+}
+
+// Merges the entries that overlap the range from start_ns to end_ns, so the
+// range is rounded to whole entries. Returns the number of merged entries.
+int histogram_series_range(struct histogram_series const *series, int64_t const start_ns, int64_t const end_ns, struct histogram *h) {
+    histogram_init(h);
+    int n = 0;
+    for (uint32_t i = 0; i < series->nbr_entries; i++) {
+        if (series->entries[i].start_ns < end_ns && series->entries[i].end_ns > start_ns) {
+            merge_entry(h, &series->entries[i]);
+            n++;
+        }
+    }
+    if (series->current_open && series->current_start_ns < end_ns && series->current_end_ns > start_ns) {
+        histogram_merge(h, series->current);
+        n++;
+    }
+    return n;
+}
+
+uint64_t histogram_series_bytes(struct histogram_series const *series) {
+    uint64_t bytes = series->max_entries * sizeof(struct histogram_series_entry) + sizeof(struct histogram);
+    for (uint32_t i = 0; i < series->nbr_entries; i++) {
+        bytes += series->entries[i].nbr_buckets * sizeof(struct histogram_series_bucket);
+    }
+    return bytes;
+}
+
+// Runs the percentile test loop for duration_ns (0 runs forever), adding the
+// diffs of each interval of the series to a histogram that is added to the
+// series and given to callback. The time spent between the intervals is not
+// counted as a diff.
+int clocktick_run_series(struct clocktick_context const *context, struct histogram_series *series, int64_t const duration_ns, \
+                         series_report_callback callback, void *arg) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (!clocktick_units_in_ns(&ctx) && !ctx.cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    if (duration_ns < 0 || series->entries == NULL) {
+        return clocktick_error_argument;
+    }
+    struct histogram *interval = malloc(sizeof(struct histogram));
+    if (interval == NULL) {
+        return clocktick_error_system;
+    }
+    histogram_init(interval);
+    struct series_report r = {.series = series, .interval = interval};
+    int64_t const interval_length = clocktick_from_ns(&ctx, series->interval_ns);
+    int64_t const start = clocktick_get_timevalue(&ctx);
+    int64_t const end = start + clocktick_from_ns(&ctx, duration_ns);
+    int64_t interval_start = start;
+    int64_t interval_end = start + interval_length;
+    int64_t prev = start, next;
+
+    while (duration_ns == 0 || prev < end) {
+        for (int i = 0; i < series_reads_per_check; i++) {
+            next = clocktick_get_timevalue(&ctx);
+            histogram_add(interval, next - prev);
+            prev = next;
+        }
+        if (prev >= interval_end || (duration_ns != 0 && prev >= end)) {
+            r.start_ns = clocktick_to_ns(&ctx, interval_start - start);
+            r.end_ns = clocktick_to_ns(&ctx, prev - start);
+            status = histogram_series_add(series, r.start_ns, r.end_ns, interval);
+            if (status < 0) {
+                break;
+            }
+            callback(&r, arg);
+            r.index++;
+            histogram_init(interval);
+            interval_end += interval_length;
+            if (interval_end <= prev) {
+                interval_end = prev + interval_length;
+            }
+            prev = clocktick_get_timevalue(&ctx);
+            interval_start = prev;
+        }
+    }
+    free(interval);
+    return status;
+}
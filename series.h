@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stdint.h>
+#include "clocktick.h"
+#include "histogram.h"
+
+// Time series of histograms for long runs. The diffs of each interval (e.g.
+// one second) go to a histogram, which is stored in a compact form that keeps
+// only the non-empty buckets. The store holds at most max_entries entries:
+// when it is full, neighbouring entries are merged, so the resolution of the
+// whole series halves but the memory stays bounded for runs of any length.
+// Entries can be merged back to one histogram for any time range.
+
+struct histogram_series_bucket {
+    uint32_t index;
+    uint64_t count;
+};
+
+// Times are in ns from the start of the run
+struct histogram_series_entry {
+    int64_t start_ns;
+    int64_t end_ns;
+    uint64_t count;
+    int64_t min;
+    int64_t max;
+    uint32_t nbr_buckets;
+    struct histogram_series_bucket *buckets;
+};
+
+struct histogram_series {
+    int64_t interval_ns;
+    uint64_t intervals_per_entry;   // a power of two
+    uint32_t max_entries;
+    uint32_t nbr_entries;
+    struct histogram_series_entry *entries;
+    struct histogram *current;  // entry being filled, not yet compacted
+    bool current_open;
+    uint64_t current_intervals;
+    int64_t current_start_ns;
+    int64_t current_end_ns;
+};
+
+struct series_report {
+    uint64_t index;
+    int64_t start_ns;
+    int64_t end_ns;
+    struct histogram const *interval;
+    struct histogram_series const *series;
+};
+
+typedef void (*series_report_callback)(struct series_report const *, void *);
+
+int histogram_series_init(struct histogram_series *, int64_t const, uint32_t const);
+void histogram_series_free(struct histogram_series *);
+int histogram_series_add(struct histogram_series *, int64_t const, int64_t const, struct histogram const *);
+uint32_t histogram_series_nbr_entries(struct histogram_series const *);
+void histogram_series_get(struct histogram_series const *, uint32_t const, struct histogram *, int64_t *, int64_t *);
+int histogram_series_range(struct histogram_series const *, int64_t const, int64_t const, struct histogram *);
+uint64_t histogram_series_bytes(struct histogram_series const *);
+int clocktick_run_series(struct clocktick_context const *, struct histogram_series *, int64_t const, series_report_callback, void *);
+
+#endif // SERIES_H
@@ -0,0 +1,354 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "simd.h"
+
+// The CPU is checked once per process. simd_set_level can lower the level in
+// use for the whole process, e.g. to compare the kernels with the scalar
+// versions.
+static pthread_once_t simd_detect_once = PTHREAD_ONCE_INIT;
+static enum simd_level simd_detected_level;
+static int simd_level_limit = simd_avx512;
+
+enum simd_level simd_detect_level(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        return simd_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return simd_avx2;
+    }
+    return simd_scalar;
+}
+
+static void simd_init_detected_level(void) {
+    simd_detected_level = simd_detect_level();
+}
+
+enum simd_level simd_get_level(void) {
+    pthread_once(&simd_detect_once, &simd_init_detected_level);
+    int const limit = __atomic_load_n(&simd_level_limit, __ATOMIC_RELAXED);
+    return (limit < (int) simd_detected_level) ? (enum simd_level) limit : simd_detected_level;
+}
+
+// Returns the level in use, which is never higher than what the CPU supports
+enum simd_level simd_set_level(enum simd_level const level) {
+    __atomic_store_n(&simd_level_limit, (int) level, __ATOMIC_RELAXED);
+    return simd_get_level();
+}
+
+char const *simd_level_name(enum simd_level const level) {
+    switch (level) {
+    case simd_avx2:
+        return "AVX2";
+    case simd_avx512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+
+static int int_comparison(const void *i, const void *j) {
+    return (*(int64_t const*) i < *(int64_t const*) j) ? -1:1;
+}
+
+// Same update as in find_highest_values, highest_values[0] is the smallest
+static inline void insert_highest_value(int64_t *highest_values, unsigned int const nbr_highest_values, int64_t const v) {
+    if (v > highest_values[0]) {
+        highest_values[0] = v;
+        qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+    }
+}
+
+//
+// Conversion to ns. Values are int64_t slots, and step 2 converts only every
+// other slot, i.e. the timestamps of struct cumulative_test_results.
+//
+
+static void to_ns_scalar(int64_t *v, uint64_t const nbr_slots, uint64_t const step, int64_t const base, int64_t const base_ns, double const multiplier) {
+    for (uint64_t i = 0; i < nbr_slots; i += step) {
+        v[i] = base_ns + (int64_t) ((double) (v[i] - base) * multiplier);
+    }
+}
+
+// AVX2 has no conversions between int64_t and double, so use the exact
+// conversion with a magic number, which works for values below 2^51.
+// Vectors with larger values are converted with the scalar code.
+__attribute__((target("avx2")))
+static void to_ns_avx2(int64_t *v, uint64_t const nbr_slots, uint64_t const step, int64_t const base, int64_t const base_ns, double const multiplier) {
+    __m256i const vbase = _mm256_set1_epi64x(base);
+    __m256i const vbase_ns = _mm256_set1_epi64x(base_ns);
+    __m256d const vmultiplier = _mm256_set1_pd(multiplier);
+    __m256i const magic_i = _mm256_set1_epi64x(0x4338000000000000LL);  // 2^52 + 2^51
+    __m256d const magic_d = _mm256_castsi256_pd(magic_i);
+    __m256i const half_range = _mm256_set1_epi64x(1LL << 51);
+    __m256d const limit = _mm256_set1_pd(0x1p51);
+    __m256d const sign = _mm256_set1_pd(-0.0);
+    __m256i const lanes = (step == 1) ? _mm256_set1_epi64x(-1) : _mm256_set_epi64x(0, -1, 0, -1);
+    uint64_t i = 0;
+    for (; i + 4 <= nbr_slots; i += 4) {
+        __m256i const x = _mm256_loadu_si256((__m256i const *) &v[i]);
+        __m256i const delta = _mm256_sub_epi64(x, vbase);
+        __m256i const delta_too_big = _mm256_srli_epi64(_mm256_add_epi64(delta, half_range), 52);
+        __m256d const d = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(delta, magic_i)), magic_d);
+        __m256d const y = _mm256_round_pd(_mm256_mul_pd(d, vmultiplier), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256d const y_too_big = _mm256_cmp_pd(_mm256_andnot_pd(sign, y), limit, _CMP_GE_OQ);
+        __m256i const bad = _mm256_and_si256(_mm256_or_si256(delta_too_big, _mm256_castpd_si256(y_too_big)), lanes);
+        if (!_mm256_testz_si256(bad, bad)) {
+            to_ns_scalar(&v[i], 4, step, base, base_ns, multiplier);
+            continue;
+        }
+        __m256i r = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(y, magic_d)), magic_i);
+        r = _mm256_add_epi64(r, vbase_ns);
+        _mm256_storeu_si256((__m256i *) &v[i], _mm256_blendv_epi8(x, r, lanes));
+    }
+    to_ns_scalar(&v[i], nbr_slots - i, step, base, base_ns, multiplier);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static void to_ns_avx512(int64_t *v, uint64_t const nbr_slots, uint64_t const step, int64_t const base, int64_t const base_ns, double const multiplier) {
+    __m512i const vbase = _mm512_set1_epi64(base);
+    __m512i const vbase_ns = _mm512_set1_epi64(base_ns);
+    __m512d const vmultiplier = _mm512_set1_pd(multiplier);
+    __mmask8 const lanes = (step == 1) ? 0xff : 0x55;
+    uint64_t i = 0;
+    for (; i + 8 <= nbr_slots; i += 8) {
+        __m512i const delta = _mm512_sub_epi64(_mm512_loadu_si512(&v[i]), vbase);
+        __m512d const y = _mm512_mul_pd(_mm512_cvtepi64_pd(delta), vmultiplier);
+        _mm512_mask_storeu_epi64(&v[i], lanes, _mm512_add_epi64(_mm512_cvttpd_epi64(y), vbase_ns));
+    }
+    to_ns_scalar(&v[i], nbr_slots - i, step, base, base_ns, multiplier);
+}
+
+static void to_ns(int64_t *v, uint64_t const nbr_slots, uint64_t const step, double const multiplier) {
+    if (nbr_slots == 0) {
+        return;
+    }
+    int64_t const base = v[0];
+    int64_t const base_ns = (int64_t) ((double) base * multiplier);
+    switch (simd_get_level()) {
+    case simd_avx512:
+        to_ns_avx512(v, nbr_slots, step, base, base_ns, multiplier);
+        break;
+    case simd_avx2:
+        to_ns_avx2(v, nbr_slots, step, base, base_ns, multiplier);
+        break;
+    default:
+        to_ns_scalar(v, nbr_slots, step, base, base_ns, multiplier);
+    }
+}
+
+void simd_to_ns(int64_t *values, uint64_t const n, double const multiplier) {
+    to_ns(values, n, 1, multiplier);
+}
+
+void simd_timestamps_to_ns(struct cumulative_test_results *results, uint64_t const n, double const multiplier) {
+    to_ns((int64_t *) results, 2 * n, 2, multiplier);
+}
+
+//
+// Threshold filtering: copy the values larger than threshold to out, in order.
+// Returns the number of copied values.
+//
+
+static uint64_t filter_above_scalar(int64_t const *values, uint64_t const n, int64_t const threshold, int64_t *out) {
+    uint64_t k = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (values[i] > threshold) {
+            out[k++] = values[i];
+        }
+    }
+    return k;
+}
+
+__attribute__((target("avx2")))
+static uint64_t filter_above_avx2(int64_t const *values, uint64_t const n, int64_t const threshold, int64_t *out) {
+    __m256i const vthreshold = _mm256_set1_epi64x(threshold);
+    uint64_t i = 0, k = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i const v = _mm256_loadu_si256((__m256i const *) &values[i]);
+        unsigned int mask = (unsigned int) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, vthreshold)));
+        while (mask != 0) {
+            out[k++] = values[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+    }
+    return k + filter_above_scalar(&values[i], n - i, threshold, &out[k]);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t filter_above_avx512(int64_t const *values, uint64_t const n, int64_t const threshold, int64_t *out) {
+    __m512i const vthreshold = _mm512_set1_epi64(threshold);
+    uint64_t i = 0, k = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i const v = _mm512_loadu_si512(&values[i]);
+        __mmask8 const mask = _mm512_cmpgt_epi64_mask(v, vthreshold);
+        _mm512_mask_compressstoreu_epi64(&out[k], mask, v);
+        k += (uint64_t) __builtin_popcount(mask);
+    }
+    return k + filter_above_scalar(&values[i], n - i, threshold, &out[k]);
+}
+
+uint64_t simd_filter_above(int64_t const *values, uint64_t const n, int64_t const threshold, int64_t *out) {
+    switch (simd_get_level()) {
+    case simd_avx512:
+        return filter_above_avx512(values, n, threshold, out);
+    case simd_avx2:
+        return filter_above_avx2(values, n, threshold, out);
+    default:
+        return filter_above_scalar(values, n, threshold, out);
+    }
+}
+
+//
+// Top-K of the diffs. Most diffs are below the smallest of the highest values,
+// so the vector versions only compare and fall back to the scalar update for
+// the few vectors that have a larger diff.
+//
+
+static void find_highest_values_scalar(struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values) {
+    for (uint64_t i = 0; i < n; i++) {
+        insert_highest_value(highest_values, nbr_highest_values, results[i].diff);
+    }
+}
+
+__attribute__((target("avx2")))
+static void find_highest_values_avx2(struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values) {
+    __m256i const diffs = _mm256_set_epi64x(-1, 0, -1, 0);
+    __m256i threshold = _mm256_set1_epi64x(highest_values[0]);
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i const v1 = _mm256_loadu_si256((__m256i const *) &results[i]);
+        __m256i const v2 = _mm256_loadu_si256((__m256i const *) &results[i + 2]);
+        __m256i const larger = _mm256_and_si256(_mm256_or_si256(_mm256_cmpgt_epi64(v1, threshold), _mm256_cmpgt_epi64(v2, threshold)), diffs);
+        if (!_mm256_testz_si256(larger, larger)) {
+            find_highest_values_scalar(&results[i], 4, highest_values, nbr_highest_values);
+            threshold = _mm256_set1_epi64x(highest_values[0]);
+        }
+    }
+    find_highest_values_scalar(&results[i], n - i, highest_values, nbr_highest_values);
+}
+
+__attribute__((target("avx512f")))
+static void find_highest_values_avx512(struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values) {
+    __m512i threshold = _mm512_set1_epi64(highest_values[0]);
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m512i const v = _mm512_loadu_si512(&results[i]);
+        if (_mm512_mask_cmpgt_epi64_mask(0xaa, v, threshold) != 0) {
+            find_highest_values_scalar(&results[i], 4, highest_values, nbr_highest_values);
+            threshold = _mm512_set1_epi64(highest_values[0]);
+        }
+    }
+    find_highest_values_scalar(&results[i], n - i, highest_values, nbr_highest_values);
+}
+
+void simd_find_highest_values(struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values) {
+    switch (simd_get_level()) {
+    case simd_avx512:
+        find_highest_values_avx512(results, n, highest_values, nbr_highest_values);
+        break;
+    case simd_avx2:
+        find_highest_values_avx2(results, n, highest_values, nbr_highest_values);
+        break;
+    default:
+        find_highest_values_scalar(results, n, highest_values, nbr_highest_values);
+    }
+    qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+}
+
+//
+// Windowed sums and top-K of the sums. A window ends at the first event at
+// least time_interval after the start of the window. The vector versions sum
+// the diffs of whole vectors until a vector has the end of the window.
+//
+
+struct window_state {
+    int64_t start;
+    int64_t limit;
+    int64_t sum;
+};
+
+static void cumulative_scalar(struct window_state *w, struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values, int64_t const time_interval) {
+    for (uint64_t i = 0; i < n; i++) {
+        w->sum += results[i].diff;
+        if (results[i].timestamp >= w->limit) {
+            w->start = results[i].timestamp;
+            w->limit = w->start + time_interval;
+            insert_highest_value(highest_values, nbr_highest_values, w->sum);
+            w->sum = 0;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static int64_t horizontal_sum_avx2(__m256i const v) {
+    __m128i const s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+}
+
+__attribute__((target("avx2")))
+static void cumulative_avx2(struct window_state *w, struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values, int64_t const time_interval) {
+    __m256i const timestamps = _mm256_set_epi64x(0, -1, 0, -1);
+    __m256i const diffs = _mm256_set_epi64x(-1, 0, -1, 0);
+    __m256i last_before_limit = _mm256_set1_epi64x(w->limit - 1);
+    __m256i sum = _mm256_setzero_si256();
+    uint64_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m256i const v = _mm256_loadu_si256((__m256i const *) &results[i]);
+        __m256i const ended = _mm256_and_si256(_mm256_cmpgt_epi64(v, last_before_limit), timestamps);
+        if (_mm256_testz_si256(ended, ended)) {
+            sum = _mm256_add_epi64(sum, _mm256_and_si256(v, diffs));
+            continue;
+        }
+        w->sum += horizontal_sum_avx2(sum);
+        sum = _mm256_setzero_si256();
+        cumulative_scalar(w, &results[i], 2, highest_values, nbr_highest_values, time_interval);
+        last_before_limit = _mm256_set1_epi64x(w->limit - 1);
+    }
+    w->sum += horizontal_sum_avx2(sum);
+    cumulative_scalar(w, &results[i], n - i, highest_values, nbr_highest_values, time_interval);
+}
+
+__attribute__((target("avx512f")))
+static void cumulative_avx512(struct window_state *w, struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values, int64_t const time_interval) {
+    __m512i last_before_limit = _mm512_set1_epi64(w->limit - 1);
+    __m512i sum = _mm512_setzero_si512();
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m512i const v = _mm512_loadu_si512(&results[i]);
+        if (_mm512_mask_cmpgt_epi64_mask(0x55, v, last_before_limit) == 0) {
+            sum = _mm512_mask_add_epi64(sum, 0xaa, sum, v);
+            continue;
+        }
+        w->sum += _mm512_reduce_add_epi64(sum);
+        sum = _mm512_setzero_si512();
+        cumulative_scalar(w, &results[i], 4, highest_values, nbr_highest_values, time_interval);
+        last_before_limit = _mm512_set1_epi64(w->limit - 1);
+    }
+    w->sum += _mm512_reduce_add_epi64(sum);
+    cumulative_scalar(w, &results[i], n - i, highest_values, nbr_highest_values, time_interval);
+}
+
+void simd_find_highest_cumulative_values(struct cumulative_test_results const *results, uint64_t const n, int64_t *highest_values, unsigned int const nbr_highest_values, int64_t const time_interval) {
+    if (n > 0) {
+        struct window_state w = {.start = results[0].timestamp, .limit = results[0].timestamp + time_interval, .sum = 0};
+        switch (simd_get_level()) {
+        case simd_avx512:
+            cumulative_avx512(&w, results, n, highest_values, nbr_highest_values, time_interval);
+            break;
+        case simd_avx2:
+            cumulative_avx2(&w, results, n, highest_values, nbr_highest_values, time_interval);
+            break;
+        default:
+            cumulative_scalar(&w, results, n, highest_values, nbr_highest_values, time_interval);
+        }
+    }
+    qsort(highest_values, nbr_highest_values, sizeof(int64_t), &int_comparison);
+}
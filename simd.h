@@ -0,0 +1,38 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+#include "clocktick.h"
+
+// Vectorized post-processing of large result sets. Every kernel has a scalar
+// version and AVX2 and AVX-512 versions that are chosen at runtime from the
+// CPU features. All versions give exactly the same results.
+//
+// Conversion to ns is done relative to the first value, as
+// base_ns + (int64_t) ((double) (value - base) * multiplier), so that the
+// vector versions can convert the differences exactly.
+
+enum simd_level {
+    simd_scalar,
+    simd_avx2,
+    simd_avx512
+};
+
+enum simd_level simd_detect_level(void);
+enum simd_level simd_get_level(void);
+enum simd_level simd_set_level(enum simd_level const);
+char const *simd_level_name(enum simd_level const);
+
+void simd_to_ns(int64_t *, uint64_t const, double const);
+void simd_timestamps_to_ns(struct cumulative_test_results *, uint64_t const, double const);
+uint64_t simd_filter_above(int64_t const *, uint64_t const, int64_t const, int64_t *);
+void simd_find_highest_values(struct cumulative_test_results const *, uint64_t const, int64_t *, unsigned int const);
+void simd_find_highest_cumulative_values(struct cumulative_test_results const *, uint64_t const, int64_t *, unsigned int const, int64_t const);
+
+#endif // SIMD_H
@@ -12,8 +12,26 @@
 #include <inttypes.h>
 #include <cmocka.h>
 #include <wordexp.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "clocktick_jumps.h"
+#include "event_store.h"
+#include "correlated_test.h"
+#include "wakeup_test.h"
+#include "histogram.h"
+#include "sentinel.h"
+#include "simd.h"
+#include "series.h"
+#include "calibration_cache.h"
+#include "adaptive.h"
+#include "result_summary.h"
+#include "diff_store.h"
+#include "handoff_test.h"
+#include "exit_cost.h"
+#include "throughput_test.h"
+#include "flight_recorder.h"
 
 static void null_test_success(void **state) {
     (void) state; 
@@ -114,6 +132,19 @@ static void test_parse_command_line_nonsense(void **state) {
 
     assert_return_code(wordexp("cj -i -13", &p, 0), 0);
     assert_int_equal(parse_command_line(p.we_wordc, p.we_wordv, &cl), -1);
+
+    assert_return_code(wordexp("cj -S -N", &p, 0), 0);
+    assert_int_equal(parse_command_line(p.we_wordc, p.we_wordv, &cl), -1);
+
+    // Only the sentinel runs until it is stopped
+    cl = default_arguments;
+    assert_return_code(wordexp("cj -d 0", &p, 0), 0);
+    assert_int_equal(parse_command_line(p.we_wordc, p.we_wordv, &cl), -1);
+    cl = default_arguments;
+    assert_return_code(wordexp("cj -r sentinel -d 0 -I 1000000000", &p, 0), 0);
+    assert_int_equal(parse_command_line(p.we_wordc, p.we_wordv, &cl), 0);
+    assert_int_equal(cl.duration_s, 0);
+    assert_true(cl.series_interval_given);
 }
 
 // Sanity check for get_tsc
@@ -229,6 +260,22 @@ static void test_run_percentile_test(void **state) {
     assert_int_equal(results[9], 10);
 }
 
+static void test_run_percentile_test_streaming(void **state) {
+    struct clocktick_context ctx = clocktick_context_for('m');
+    // Start off a cache line and leave a tail, so all three store paths run
+    int64_t *buffer = aligned_alloc(64, 64 * sizeof(int64_t));
+    int64_t *results = &buffer[3];
+    int64_t expected[50];
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_percentile_test(&ctx, expected, 50), clocktick_ok);
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_percentile_test_streaming(&ctx, results, 50), clocktick_ok);
+    assert_memory_equal(results, expected, sizeof(expected));
+    assert_int_equal(results[5], 32);
+    assert_int_equal(results[49], 10);
+    free(buffer);
+}
+
 static void test_run_highest_test(void **state) {
     assert_int_equal(mock_get_timevalue(true), 0);
     int64_t *results = run_highest_test(100, 'm', 10);
@@ -399,6 +446,852 @@ static void test_find_highest_cumulative_values(void **state) {
 
 }
 
+static void test_event_store(void **state) {
+    struct event_store store;
+    assert_return_code(event_store_init(&store, 3 * sizeof(struct event_store_block)), 0);
+    // Enough events to span several blocks, with both small and large values
+    uint64_t const n = 5000;
+    int64_t timestamp = 123456789;
+    for (uint64_t i = 0; i < n; i++) {
+        timestamp += 100 + (int64_t) (i % 7) * 1000;
+        int64_t diff = (i % 1000 == 0) ? one_billion : (int64_t) (i % 13);
+        assert_true(event_store_append(&store, timestamp, diff));
+    }
+    assert_int_equal(store.nbr_events, n);
+    assert_true(store.current_block > 0);
+
+    struct event_store_cursor cursor;
+    struct cumulative_test_results event;
+    event_store_cursor_init(&cursor, &store);
+    timestamp = 123456789;
+    for (uint64_t i = 0; i < n; i++) {
+        timestamp += 100 + (int64_t) (i % 7) * 1000;
+        assert_true(event_store_next(&cursor, &event));
+        assert_int_equal(event.timestamp, timestamp);
+        assert_int_equal(event.diff, (i % 1000 == 0) ? one_billion : (int64_t) (i % 13));
+    }
+    assert_false(event_store_next(&cursor, &event));
+
+    struct cumulative_test_results block[event_store_block_size/2];
+    uint32_t decoded = event_store_decode_block(&store, 0, block);
+    assert_int_equal(decoded, store.blocks[0].nbr_events);
+    assert_int_equal(block[0].timestamp, 123456789 + 100);
+    assert_int_equal(block[0].diff, one_billion);
+    event_store_free(&store);
+
+    // A full store refuses new events
+    assert_return_code(event_store_init(&store, 0), 0);
+    uint64_t appended = 0;
+    while (event_store_append(&store, (int64_t) appended * one_million, -1)) {
+        appended++;
+    }
+    assert_int_equal(store.nbr_events, appended);
+    assert_true(appended > 100);
+    // The header of the block, 2 bytes for the first event and 4 for the others
+    assert_int_equal(event_store_bytes_used(&store), 16 + 2 + (appended - 1) * 4);
+    assert_int_equal(event_store_bytes_allocated(&store), sizeof(struct event_store_block));
+    assert_return_code(event_store_grow(&store), 0);
+    assert_true(event_store_append(&store, (int64_t) appended * one_million, -1));
+    assert_int_equal(store.current_block, 1);
+    event_store_free(&store);
+}
+
+static void test_find_highest_values_in_event_store(void **state) {
+    struct cumulative_test_results results[10] = {
+            {0, 1},
+            {1, 2},
+            {2, 3},
+            {3, 4},
+            {4, 5},
+            {5, 6},
+            {6, 7},
+            {7, 8},
+            {8, 9},
+            {9, 10}
+    };
+    struct event_store store;
+    assert_return_code(event_store_init(&store, 0), 0);
+    for (int i = 0; i < 10; i++) {
+        assert_true(event_store_append(&store, results[i].timestamp, results[i].diff));
+    }
+    int64_t highest_values[5] = {0};
+    int64_t highest_values_from_store[5] = {0};
+    find_highest_values(results, 10, highest_values, 5);
+    find_highest_values_in_event_store(&store, highest_values_from_store, 5);
+    assert_memory_equal(highest_values, highest_values_from_store, sizeof(highest_values));
+
+    int64_t highest_cum_values[5] = {0};
+    int64_t highest_cum_values_from_store[5] = {0};
+    find_highest_cumulative_values(results, 10, highest_cum_values, 5, 2);
+    find_highest_cumulative_values_in_event_store(&store, highest_cum_values_from_store, 5, 2);
+    assert_memory_equal(highest_cum_values, highest_cum_values_from_store, sizeof(highest_cum_values));
+    event_store_free(&store);
+}
+
+static void test_run_cumulative_test_compact(void **state) {
+    struct event_store store;
+    assert_return_code(event_store_init(&store, 0), 0);
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(run_cumulative_test_compact_with_baseline(10, 5, 'm', &store), 10);
+    struct event_store_cursor cursor;
+    struct cumulative_test_results event;
+    event_store_cursor_init(&cursor, &store);
+    assert_true(event_store_next(&cursor, &event));
+    assert_int_equal(event.timestamp, 1);
+    assert_int_equal(event.diff, 0);
+    // next differences are 1, 2, 4
+    assert_true(event_store_next(&cursor, &event));
+    assert_int_equal(event.timestamp, 8);
+    assert_int_equal(event.diff, 3);
+    assert_true(event_store_next(&cursor, &event));
+    assert_int_equal(event.timestamp, 16);
+    assert_int_equal(event.diff, 11);
+    event_store_free(&store);
+}
+
+static void test_parse_cpu_list(void **state) {
+    int cpus[8];
+    assert_int_equal(parse_cpu_list("3", cpus, 8), 1);
+    assert_int_equal(cpus[0], 3);
+    assert_int_equal(parse_cpu_list("1,2,5-7", cpus, 8), 5);
+    assert_int_equal(cpus[0], 1);
+    assert_int_equal(cpus[1], 2);
+    assert_int_equal(cpus[2], 5);
+    assert_int_equal(cpus[3], 6);
+    assert_int_equal(cpus[4], 7);
+    assert_int_equal(parse_cpu_list("0-8", cpus, 8), -1);
+    assert_int_equal(parse_cpu_list("1,x", cpus, 8), -1);
+    assert_int_equal(parse_cpu_list("4-2", cpus, 8), -1);
+
+    struct command_line_arguments cl = default_arguments;
+    wordexp_t p;
+    assert_return_code(wordexp("cj -r correlated -P 2-4 -s 500 -d 3", &p, 0), 0);
+    assert_return_code(parse_command_line(p.we_wordc, p.we_wordv, &cl), 0);
+    assert_int_equal(cl.reporttype, 'x');
+    assert_int_equal(cl.nbr_correlated_cpus, 3);
+    assert_int_equal(cl.correlated_cpus[2], 4);
+    assert_int_equal(cl.stall_threshold_ns, 500);
+    assert_int_equal(cl.duration_s, 3);
+}
+
+static void test_classify_correlated_stalls(void **state) {
+    // Samplers 0 and 1 are on socket 0, samplers 2 and 3 on socket 1
+    int const sockets[4] = {0, 0, 1, 1};
+    struct stall_interval stalls[] = {
+            // global: all four overlap, transitively
+            {100, 200, 0}, {110, 210, 1}, {190, 300, 2}, {295, 310, 3},
+            // socket: both samplers of socket 1
+            {1000, 1100, 2}, {1050, 1120, 3},
+            // local: one sampler only, and two samplers of different sockets
+            {2000, 2010, 0},
+            {3000, 3050, 1}, {3010, 3020, 2},
+            // outside the common window
+            {9000, 9500, 0}, {9000, 9500, 1}, {9000, 9500, 2}, {9000, 9500, 3},
+    };
+    uint64_t const nbr_stalls = sizeof(stalls)/sizeof(stalls[0]);
+    struct stall_class_summary summary[nbr_stall_classes];
+    classify_correlated_stalls(stalls, nbr_stalls, sockets, 4, 0, 5000, summary);
+    assert_int_equal(summary[stall_class_global].count, 1);
+    assert_int_equal(summary[stall_class_global].wall_time, 210);
+    assert_int_equal(summary[stall_class_global].cpu_time, 100 + 100 + 110 + 15);
+    assert_int_equal(summary[stall_class_global].longest, 210);
+    assert_int_equal(summary[stall_class_socket].count, 1);
+    assert_int_equal(summary[stall_class_socket].wall_time, 120);
+    assert_int_equal(summary[stall_class_socket].cpu_time, 170);
+    assert_int_equal(summary[stall_class_local].count, 2);
+    assert_int_equal(summary[stall_class_local].wall_time, 10 + 50);
+    assert_int_equal(summary[stall_class_local].longest, 50);
+}
+
+static void test_run_wakeup_test(void **state) {
+    struct command_line_arguments cl = default_arguments;
+    wordexp_t p;
+    assert_return_code(wordexp("cj -r wakeup -w timerfd -t 200000", &p, 0), 0);
+    assert_return_code(parse_command_line(p.we_wordc, p.we_wordv, &cl), 0);
+    assert_int_equal(cl.reporttype, 'w');
+    assert_int_equal(cl.wakeup_method, 'f');
+    assert_string_equal(*cl.wakeup_method_name, "timerfd");
+
+    assert_return_code(wordexp("cj -w busyloop", &p, 0), 0);
+    assert_int_equal(parse_command_line(p.we_wordc, p.we_wordv, &cl), -1);
+
+    // Overshoots are small compared to the 1 ms period, also in clock ticks
+    char const methods[] = {'n', 'f', 'h'};
+    int64_t results[10];
+    struct clocktick_context ctx_r = clocktick_context_for('r');
+    struct clocktick_context ctx_p = clocktick_context_for('p');
+    for (int m = 0; m < 3; m++) {
+        assert_int_equal(clocktick_run_wakeup_test(&ctx_r, methods[m], one_million, results, 10), clocktick_ok);
+        for (int i = 0; i < 10; i++) {
+            assert_in_range(results[i], -10000, 10 * one_million);
+        }
+        assert_int_equal(clocktick_run_wakeup_test(&ctx_p, methods[m], one_million, results, 10), clocktick_ok);
+        for (int i = 0; i < 10; i++) {
+            assert_in_range(cyc2ns(results[i]), -10000, 10 * one_million);
+        }
+    }
+    // The mock clock without a mock function can not be read
+    struct clocktick_context ctx_m;
+    assert_int_equal(clocktick_init(&ctx_m, 'm'), clocktick_ok);
+    assert_int_equal(clocktick_run_wakeup_test(&ctx_m, 'n', one_million, results, 1), clocktick_error_clocktype);
+}
+
+static void test_clocktick_context(void **state) {
+    struct clocktick_context ctx;
+    int64_t results[10];
+    assert_int_equal(clocktick_init(&ctx, 'x'), clocktick_error_clocktype);
+
+    // Mock clock without a function is an error, not a crash
+    assert_int_equal(clocktick_init(&ctx, 'm'), clocktick_ok);
+    assert_int_equal(clocktick_run_percentile_test(&ctx, results, 10), clocktick_error_clocktype);
+    ctx.mock_clock = &mock_get_timevalue;
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_percentile_test(&ctx, results, 10), clocktick_ok);
+    assert_int_equal(results[0], 1);
+    assert_int_equal(results[5], 32);
+    assert_int_equal(results[6], 10);
+
+    assert_int_equal(clocktick_run_highest_test(&ctx, 100, results, 0), clocktick_error_argument);
+    assert_int_equal(clocktick_run_highest_test(&ctx, 100, results, 3), clocktick_ok);
+    assert_int_equal(results[0], 10);
+    assert_int_equal(results[1], 10);
+    assert_int_equal(results[2], 10);
+
+    // Tsc contexts are independent and must be calibrated before converting
+    struct clocktick_context ctx_t, ctx_p;
+    assert_int_equal(clocktick_init(&ctx_t, 't'), clocktick_ok);
+    assert_int_equal(clocktick_init(&ctx_p, 'p'), clocktick_ok);
+    assert_false(clocktick_units_in_ns(&ctx_t));
+    assert_int_equal(clocktick_run_wakeup_test(&ctx_t, 'n', one_million, results, 1), clocktick_error_not_calibrated);
+    assert_int_equal(clocktick_calibrate(&ctx_t), clocktick_ok);
+    assert_true(ctx_t.cyc2ns_multiplier_initialized);
+    assert_false(ctx_p.cyc2ns_multiplier_initialized);
+    assert_in_range(clocktick_to_ns(&ctx_t, clocktick_from_ns(&ctx_t, one_million)), 0.99 * one_million, 1.01 * one_million);
+    assert_int_equal(clocktick_run_wakeup_test(&ctx_t, 'x', one_million, results, 1), clocktick_error_argument);
+
+    struct clocktick_context ctx_r;
+    assert_int_equal(clocktick_init(&ctx_r, 'r'), clocktick_ok);
+    assert_int_equal(clocktick_calibrate(&ctx_r), clocktick_ok);
+    assert_int_equal(clocktick_to_ns(&ctx_r, 12345), 12345);
+    assert_string_equal(clocktick_strerror(clocktick_error_not_calibrated), "cycles to ns calculation not initialized");
+}
+
+static void test_histogram(void **state) {
+    // Buckets cover all values without gaps
+    for (unsigned int b = 0; b + 1 < histogram_nbr_buckets; b++) {
+        assert_int_equal(histogram_bucket_highest(b) + 1, histogram_bucket_lowest(b + 1));
+        assert_int_equal(histogram_bucket(histogram_bucket_lowest(b)), b);
+        assert_int_equal(histogram_bucket(histogram_bucket_highest(b)), b);
+    }
+    assert_int_equal(histogram_bucket(INT64_MAX), histogram_nbr_buckets - 1);
+    assert_int_equal(histogram_bucket(-5), 0);
+    assert_int_equal(histogram_bucket(127), 127);
+    assert_int_equal(histogram_bucket(128), 128);
+    assert_int_equal(histogram_bucket(129), 128);
+
+    // Small values are exact, so percentiles match the sorted array
+    struct histogram *h = malloc(sizeof(struct histogram));
+    histogram_init(h);
+    assert_int_equal(histogram_percentile(h, 0.5), 0);
+    for (int64_t v = 1; v <= 100; v++) {
+        histogram_add(h, v);
+    }
+    assert_int_equal(h->count, 100);
+    assert_int_equal(h->min, 1);
+    assert_int_equal(h->max, 100);
+    assert_int_equal(histogram_percentile(h, 0.5), 51);
+    assert_int_equal(histogram_percentile(h, 0.99), 100);
+    assert_int_equal(histogram_percentile(h, 1.0), 100);
+
+    // Large values are within the bucket width
+    struct histogram *h2 = malloc(sizeof(struct histogram));
+    histogram_init(h2);
+    int64_t const large[] = {1000, 123456, 98765432, one_billion};
+    histogram_add_values(h2, large, 4);
+    assert_in_range(histogram_percentile(h2, 0.25), 123456, 123456 * 65 / 64);
+    assert_int_equal(histogram_percentile(h2, 0.99), one_billion);
+
+    histogram_merge(h, h2);
+    assert_int_equal(h->count, 104);
+    assert_int_equal(h->min, 1);
+    assert_int_equal(h->max, one_billion);
+    assert_int_equal(histogram_percentile(h, 0.5), 53);
+    free(h);
+    free(h2);
+}
+
+static void test_run_burst(void **state) {
+    struct clocktick_context ctx = clocktick_context_for('m');
+    int64_t results[100];
+    uint64_t n;
+    assert_int_equal(mock_get_timevalue(true), 0);
+    // Mock clock goes 1, 2, 4, ..., 64, 74, ... after the restart
+    assert_int_equal(clocktick_run_burst(&ctx, 50, results, 100, &n), clocktick_ok);
+    assert_int_equal(n, 6);
+    assert_int_equal(results[0], 1);
+    assert_int_equal(results[5], 32);
+    assert_int_equal(clocktick_run_burst(&ctx, 1000, results, 5, &n), clocktick_ok);
+    assert_int_equal(n, 5);
+    assert_int_equal(results[4], 10);
+}
+
+static void count_sentinel_reports(struct sentinel_report const *r, void *arg) {
+    uint64_t *samples = arg;
+    assert_true(r->interval->count > 0);
+    assert_true(r->total->count >= r->interval->count);
+    samples[0]++;
+    samples[1] += r->interval->count;
+    samples[2] = r->total->count;
+}
+
+static void test_run_sentinel(void **state) {
+    struct clocktick_context ctx = clocktick_context_for('m');
+    struct sentinel_config config = {
+        .burst_ns = 100,
+        .period_ns = 5 * one_million,
+        .cpu_budget = 0.5,
+        .report_interval_ns = 20 * one_million,
+        .duration_ns = 100 * one_million
+    };
+    uint64_t samples[3] = {0};
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_sentinel(&ctx, &config, &count_sentinel_reports, samples), clocktick_ok);
+    assert_in_range(samples[0], 3, 6);
+    assert_int_equal(samples[1], samples[2]);
+    // 20 bursts of 100 ns with the mock clock taking 10 ns steps
+    assert_in_range(samples[2], 15 * 10, 20 * 15);
+
+    // A CPU that can not be used is an error, not a burst on another CPU
+    config.cpus[0] = 1023;
+    config.nbr_cpus = 1;
+    assert_int_equal(clocktick_run_sentinel(&ctx, &config, &count_sentinel_reports, samples), clocktick_error_system);
+    config.nbr_cpus = 0;
+
+    struct clocktick_context ctx_m;
+    assert_int_equal(clocktick_init(&ctx_m, 'm'), clocktick_ok);
+    assert_int_equal(clocktick_run_sentinel(&ctx_m, &config, &count_sentinel_reports, samples), clocktick_error_clocktype);
+
+    config.period_ns = 10;
+    assert_int_equal(clocktick_run_sentinel(&ctx, &config, &count_sentinel_reports, samples), clocktick_error_argument);
+}
+
+// All vector levels the CPU has must give the same results as the scalar code
+static void test_simd_kernels(void **state) {
+    enum { n = 10007, nbr_highest = 10 };
+    struct cumulative_test_results *results = malloc(n * sizeof(struct cumulative_test_results));
+    struct cumulative_test_results *converted = malloc(n * sizeof(struct cumulative_test_results));
+    int64_t *values = malloc(n * sizeof(int64_t));
+    int64_t *filtered = malloc(n * sizeof(int64_t));
+    int64_t *expected = malloc(n * sizeof(int64_t));
+    int64_t *filtered_expected = malloc(n * sizeof(int64_t));
+    srand(1);
+    int64_t t = 1LL << 40;
+    for (uint64_t i = 0; i < n; i++) {
+        t += 10 + rand() % 1000;
+        results[i].timestamp = t;
+        results[i].diff = (rand() % 100 == 0) ? rand() % 100000 : rand() % 50;
+        values[i] = (i % 1000 == 999) ? (int64_t) 1 << 60 : t;
+    }
+    enum simd_level const detected = simd_detect_level();
+
+    simd_set_level(simd_scalar);
+    int64_t highest[nbr_highest] = {0}, cumulative[nbr_highest] = {0};
+    simd_find_highest_values(results, n, highest, nbr_highest);
+    simd_find_highest_cumulative_values(results, n, cumulative, nbr_highest, 20000);
+    memcpy(expected, values, n * sizeof(int64_t));
+    simd_to_ns(expected, n, 0.37);
+    // Relative conversion may round differently from the absolute one
+    assert_in_range(expected[n - 1] - (int64_t) ((double) values[n - 1] * 0.37) + 1, 0, 2);
+    uint64_t const nbr_filtered = simd_filter_above(expected, n, expected[n / 2], filtered_expected);
+    assert_in_range(nbr_filtered, n / 2 - 1, n / 2 + 20);
+    memcpy(converted, results, n * sizeof(struct cumulative_test_results));
+    simd_timestamps_to_ns(converted, n, 2.5);
+    assert_int_equal(converted[0].timestamp, (int64_t) ((double) results[0].timestamp * 2.5));
+    assert_int_equal(converted[n - 1].diff, results[n - 1].diff);
+
+    for (int level = simd_avx2; level <= (int) detected; level++) {
+        assert_int_equal(simd_set_level(level), level);
+        int64_t h[nbr_highest] = {0}, c[nbr_highest] = {0};
+        simd_find_highest_values(results, n, h, nbr_highest);
+        assert_memory_equal(h, highest, sizeof(h));
+        simd_find_highest_cumulative_values(results, n, c, nbr_highest, 20000);
+        assert_memory_equal(c, cumulative, sizeof(c));
+
+        int64_t *v = malloc(n * sizeof(int64_t));
+        memcpy(v, values, n * sizeof(int64_t));
+        simd_to_ns(v, n, 0.37);
+        assert_memory_equal(v, expected, n * sizeof(int64_t));
+        uint64_t const k = simd_filter_above(v, n, expected[n / 2], filtered);
+        assert_int_equal(k, nbr_filtered);
+        assert_memory_equal(filtered, filtered_expected, k * sizeof(int64_t));
+        free(v);
+
+        struct cumulative_test_results *r = malloc(n * sizeof(struct cumulative_test_results));
+        memcpy(r, results, n * sizeof(struct cumulative_test_results));
+        simd_set_level(level);
+        simd_timestamps_to_ns(r, n, 2.5);
+        assert_memory_equal(r, converted, n * sizeof(struct cumulative_test_results));
+        free(r);
+    }
+    simd_set_level(detected);
+    free(results);
+    free(converted);
+    free(values);
+    free(filtered);
+    free(expected);
+    free(filtered_expected);
+}
+
+static void count_series_reports(struct series_report const *r, void *arg) {
+    uint64_t *samples = arg;
+    assert_int_equal(r->index, samples[0]);
+    assert_true(r->end_ns > r->start_ns);
+    samples[0]++;
+    samples[1] += r->interval->count;
+}
+
+static void test_histogram_series(void **state) {
+    struct histogram_series series;
+    assert_int_equal(histogram_series_init(&series, one_billion, 1), clocktick_error_argument);
+    assert_int_equal(histogram_series_init(&series, one_billion, 4), clocktick_ok);
+    struct histogram *h = malloc(sizeof(struct histogram));
+    for (int64_t i = 0; i < 10; i++) {
+        histogram_init(h);
+        histogram_add(h, 100 * i);
+        histogram_add(h, 100 * i + 1);
+        assert_int_equal(histogram_series_add(&series, s2ns(i), s2ns(i + 1), h), clocktick_ok);
+    }
+    // Full store was merged once, 4 entries of 2 intervals and the current one
+    assert_int_equal(series.intervals_per_entry, 2);
+    assert_int_equal(histogram_series_nbr_entries(&series), 5);
+    int64_t start, end;
+    histogram_series_get(&series, 1, h, &start, &end);
+    assert_int_equal(start, s2ns(2));
+    assert_int_equal(end, s2ns(4));
+    assert_int_equal(h->count, 4);
+    assert_int_equal(h->min, 200);
+    assert_int_equal(h->max, 301);
+    histogram_series_get(&series, 4, h, &start, &end);
+    assert_int_equal(start, s2ns(8));
+    assert_int_equal(h->max, 901);
+
+    assert_int_equal(histogram_series_range(&series, 0, INT64_MAX, h), 5);
+    assert_int_equal(h->count, 20);
+    assert_int_equal(h->min, 0);
+    assert_int_equal(h->max, 901);
+    // Range is rounded to whole entries
+    assert_int_equal(histogram_series_range(&series, s2ns(3), s2ns(5), h), 2);
+    assert_int_equal(h->count, 8);
+    assert_int_equal(h->min, 200);
+    assert_int_equal(h->max, 501);
+    assert_true(histogram_series_bytes(&series) < 2 * sizeof(struct histogram));
+    histogram_series_free(&series);
+
+    // Mock clock goes up by 10 ns for each read
+    struct clocktick_context ctx = clocktick_context_for('m');
+    uint64_t samples[2] = {0};
+    assert_int_equal(histogram_series_init(&series, 5000, 4), clocktick_ok);
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_series(&ctx, &series, 100000, &count_series_reports, samples), clocktick_ok);
+    assert_in_range(samples[0], 10, 40);
+    assert_true(histogram_series_nbr_entries(&series) <= 5);
+    assert_int_equal(histogram_series_range(&series, 0, INT64_MAX, h), histogram_series_nbr_entries(&series));
+    assert_int_equal(h->count, samples[1]);
+    // From 32 to 64 at the start of the mock clock
+    assert_int_equal(h->max, 32);
+    histogram_series_free(&series);
+    free(h);
+}
+
+static void test_calibration_cache(void **state) {
+    char path[] = "/tmp/clocktick_calibration_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+    unlink(path);
+
+    struct calibration_cache *cache = malloc(sizeof(struct calibration_cache));
+    double value;
+    assert_int_equal(calibration_cache_load(cache, path), clocktick_error_system);
+    assert_false(calibration_cache_find(cache, 'm', 't', -1, &value));
+    calibration_cache_set(cache, 'm', 't', -1, 0.4);
+    calibration_cache_set(cache, 'b', 't', 3, 30);
+    calibration_cache_set(cache, 'b', 't', 3, 31);
+    assert_int_equal(cache->nbr_entries, 2);
+    assert_int_equal(calibration_cache_save(cache, path), clocktick_ok);
+
+    assert_int_equal(calibration_cache_load(cache, path), clocktick_ok);
+    assert_true(calibration_cache_find(cache, 'm', 't', -1, &value));
+    assert_true(value == 0.4);
+    assert_true(calibration_cache_find(cache, 'b', 't', 3, &value));
+    assert_true(value == 31);
+    assert_false(calibration_cache_find(cache, 'b', 'p', 3, &value));
+
+    // Mock clock goes up by 10 ns for each read, a baseline far from that is measured again
+    struct clocktick_context ctx = clocktick_context_for('m');
+    int64_t baseline;
+    bool cached;
+    calibration_cache_set(cache, 'b', 'm', 1, 10);
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_get_baseline_time_cached(&ctx, cache, 1, &baseline, &cached), clocktick_ok);
+    assert_true(cached);
+    assert_int_equal(baseline, 10);
+    calibration_cache_set(cache, 'b', 'm', 1, 12);
+    assert_int_equal(clocktick_get_baseline_time_cached(&ctx, cache, 1, &baseline, &cached), clocktick_ok);
+    assert_false(cached);
+    assert_int_equal(baseline, 10);
+    assert_true(calibration_cache_find(cache, 'b', 'm', 1, &value));
+    assert_true(value == 10);
+
+    // A file from another boot is not used
+    assert_int_equal(calibration_cache_save(cache, path), clocktick_ok);
+    FILE *f = fopen(path, "r+");
+    fputs("boot_id 0", f);
+    fclose(f);
+    assert_int_equal(calibration_cache_load(cache, path), clocktick_error_system);
+    assert_int_equal(cache->nbr_entries, 0);
+    unlink(path);
+
+    // The directory of the file is created only when saving
+    char dir[] = "/tmp/clocktick_calibration_dir_XXXXXX";
+    assert_non_null(mkdtemp(dir));
+    rmdir(dir);
+    char file[512];
+    snprintf(file, sizeof(file), "%s/cache", dir);
+    calibration_cache_set(cache, 'm', 't', -1, 0.4);
+    assert_int_equal(calibration_cache_save(cache, file), clocktick_ok);
+    assert_int_equal(access(file, R_OK), 0);
+    unlink(file);
+    rmdir(dir);
+    free(cache);
+}
+
+static void test_adaptive(void **state) {
+    struct histogram *batches = malloc(4 * sizeof(struct histogram));
+    struct histogram *total = malloc(sizeof(struct histogram));
+    histogram_init(total);
+    for (int i = 0; i < 4; i++) {
+        histogram_init(&batches[i]);
+        histogram_add(&batches[i], 100 + 10 * i);
+        histogram_merge(total, &batches[i]);
+    }
+    // Batches at 100, 110, 120, 130: sd 12.9, half width 3.182 * 12.9 / 2
+    struct adaptive_estimate e;
+    adaptive_estimate(batches, 4, total, 0.5, &e);
+    assert_in_range(e.value, 110, 120);
+    assert_in_range(e.half_width, 20, 22);
+    adaptive_estimate(batches, 1, total, 0.5, &e);
+    assert_int_equal(e.half_width, INT64_MAX);
+    free(batches);
+    free(total);
+
+    // Mock clock diffs are all 10 ns after the first reads, so the intervals
+    // are empty as soon as there are enough batches
+    struct clocktick_context ctx = clocktick_context_for('m');
+    double const p[] = {0.5, 0.99};
+    struct adaptive_config config = {.percentiles = p, .nbr_percentiles = 2, .tolerance = 0.01, .duration_ns = one_billion};
+    struct adaptive_result *result = malloc(sizeof(struct adaptive_result));
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_adaptive(&ctx, &config, result, NULL, NULL), clocktick_ok);
+    assert_true(result->converged);
+    assert_int_equal(result->nbr_batches, adaptive_min_batches);
+    assert_int_equal(result->batch_reads, 1024);
+    assert_int_equal(result->nbr_reads, adaptive_min_batches * 1024);
+    assert_int_equal(result->estimates[1].value, 10);
+    assert_int_equal(result->estimates[1].half_width, 0);
+
+    // Stops at the duration when the tolerance can not be reached
+    config.duration_ns = 50000;
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_adaptive(&ctx, &config, result, NULL, NULL), clocktick_ok);
+    assert_false(result->converged);
+    assert_true(result->nbr_batches < adaptive_min_batches);
+    config.tolerance = 0;
+    assert_int_equal(clocktick_run_adaptive(&ctx, &config, result, NULL, NULL), clocktick_error_argument);
+    free(result);
+}
+
+static void test_result_summary(void **state) {
+    struct result_summary *a = malloc(sizeof(struct result_summary));
+    struct result_summary *b = malloc(sizeof(struct result_summary));
+    struct result_summary *combined = malloc(sizeof(struct result_summary));
+    result_summary_init(a);
+    result_summary_init(b);
+    result_summary_init(combined);
+    int64_t values[1000];
+    for (int i = 0; i < 1000; i++) {
+        values[i] = (i * 7919) % 1000 + ((i % 97 == 0) ? 100000 + i : 0);
+    }
+    result_summary_add_values(a, values, 600);
+    result_summary_add_values(b, values + 600, 400);
+    result_summary_add_values(combined, values, 1000);
+    assert_int_equal(result_summary_set_label(a, "host", "a"), clocktick_ok);
+    assert_int_equal(result_summary_set_label(a, "rack", "1"), clocktick_ok);
+    assert_int_equal(result_summary_set_label(b, "host", "b"), clocktick_ok);
+    assert_int_equal(result_summary_set_label(b, "rack", "1"), clocktick_ok);
+    assert_int_equal(result_summary_set_label(b, "bad key", "1"), clocktick_error_argument);
+
+    char path[] = "/tmp/test_cj_summary_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+    assert_int_equal(result_summary_save(b, path), clocktick_ok);
+    assert_int_equal(result_summary_load(b, path), clocktick_ok);
+    assert_string_equal(result_summary_get_label(b, "host"), "b");
+
+    // Merged summary is the same as the summary of all values
+    assert_int_equal(result_summary_merge(a, b), clocktick_ok);
+    assert_memory_equal(&a->histogram, &combined->histogram, sizeof(struct histogram));
+    assert_int_equal(a->nbr_top, result_summary_max_top);
+    assert_memory_equal(a->top, combined->top, sizeof(a->top));
+    assert_int_equal(a->top[0], combined->histogram.max);
+    assert_string_equal(result_summary_get_label(a, "host"), "*");
+    assert_string_equal(result_summary_get_label(a, "rack"), "1");
+    // Percentiles within the largest values are exact
+    assert_int_equal(result_summary_percentile(a, 0.999), a->top[0]);
+    assert_int_equal(result_summary_percentile(a, 0.99), a->top[9]);
+    assert_int_equal(result_summary_percentile(a, 0.5), histogram_percentile(&combined->histogram, 0.5));
+
+    // Largest values that are not in the histogram are not used for percentiles
+    struct result_summary *top_only = malloc(sizeof(struct result_summary));
+    result_summary_init(top_only);
+    result_summary_add_top(top_only, 10000000);
+    assert_int_equal(result_summary_save(top_only, path), clocktick_ok);
+    assert_int_equal(result_summary_load(top_only, path), clocktick_ok);
+    assert_false(top_only->top_complete);
+    assert_true(a->top_complete);
+    assert_int_equal(result_summary_merge(a, top_only), clocktick_ok);
+    assert_false(a->top_complete);
+    assert_int_equal(a->top[0], 10000000);
+    assert_int_equal(result_summary_percentile(a, 0.999), histogram_percentile(&combined->histogram, 0.999));
+    // Summaries of different tests are not merged
+    assert_int_equal(result_summary_set_label(a, "test", "percentiles"), clocktick_ok);
+    assert_int_equal(result_summary_merge(a, top_only), clocktick_error_argument);
+    assert_int_equal(result_summary_set_label(top_only, "test", "highest"), clocktick_ok);
+    assert_int_equal(result_summary_merge(a, top_only), clocktick_error_argument);
+    free(top_only);
+
+    // Newer versions are rejected
+    FILE *f = fopen(path, "w");
+    fprintf(f, "clocktick_summary %d\ncount 0\n", result_summary_version + 1);
+    fclose(f);
+    assert_int_equal(result_summary_load(b, path), clocktick_error_argument);
+    unlink(path);
+    free(a);
+    free(b);
+    free(combined);
+}
+
+// Mock clock that jumps 0.1 ms on every read
+static int64_t jumping_clock(bool const restart) {
+    static int64_t now = 0;
+    now = restart ? 0 : now + 100000;
+    return now;
+}
+
+static void test_diff_store(void **state) {
+    struct diff_store store;
+    assert_int_equal(diff_store_init(&store, 1000, 0), clocktick_error_argument);
+    assert_int_equal(diff_store_init(&store, 1000, 4), clocktick_ok);
+    struct clocktick_context ctx = clocktick_context_for('m');
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_percentile_test_compact(&ctx, &store), clocktick_ok);
+    assert_int_equal(store.nbr_diffs, 1000);
+    assert_int_equal(store.nbr_overflow, 0);
+    assert_int_equal(diff_store_get(&store, 0), 1);
+    assert_int_equal(diff_store_sort(&store), clocktick_ok);
+    assert_int_equal(diff_store_percentile(&store, 0.5), 10);
+    assert_int_equal(diff_store_value_at_rank(&store, 999), 32);
+
+    // Stops when the overflow table is full
+    ctx.mock_clock = &jumping_clock;
+    jumping_clock(true);
+    assert_int_equal(clocktick_run_percentile_test_compact(&ctx, &store), clocktick_ok);
+    assert_int_equal(store.nbr_diffs, 4);
+    assert_int_equal(store.nbr_overflow, 4);
+    assert_int_equal(diff_store_get(&store, 3), 100000);
+    diff_store_free(&store);
+
+    // Negative and large diffs are sorted around the 16 bit ones
+    int64_t const values[] = {5, -3, 70000, 5, 0, 100000, 7, 65535};
+    int64_t const sorted[] = {-3, 0, 5, 5, 7, 65535, 70000, 100000};
+    assert_int_equal(diff_store_init(&store, 8, 8), clocktick_ok);
+    for (uint64_t i = 0; i < 8; i++) {
+        if (values[i] >= 0 && values[i] < diff_store_overflow) {
+            store.diffs[i] = (uint16_t) values[i];
+        } else {
+            store.diffs[i] = diff_store_overflow;
+            store.overflow[store.nbr_overflow].index = i;
+            store.overflow[store.nbr_overflow++].value = values[i];
+        }
+    }
+    store.nbr_diffs = 8;
+    assert_int_equal(diff_store_sort(&store), clocktick_ok);
+    for (uint64_t i = 0; i < 8; i++) {
+        assert_int_equal(diff_store_get(&store, i), values[i]);
+        assert_int_equal(diff_store_value_at_rank(&store, i), sorted[i]);
+    }
+    assert_int_equal(diff_store_percentile(&store, 0.5), 7);
+    diff_store_free(&store);
+}
+
+static void test_handoff(void **state) {
+    // Every pair is scheduled once, and no CPU twice in a round
+    for (int n = 2; n <= 9; n++) {
+        int seen[9][9] = {{0}};
+        int pairs[5][2];
+        for (int round = 0; round < n - 1 + (n % 2); round++) {
+            int used[9] = {0};
+            int const nbr_pairs = handoff_round_pairs(n, round, pairs);
+            assert_int_equal(nbr_pairs, n / 2);
+            for (int k = 0; k < nbr_pairs; k++) {
+                int const a = pairs[k][0], b = pairs[k][1];
+                assert_true(a != b && a < n && b < n);
+                used[a]++;
+                used[b]++;
+                assert_true(used[a] == 1 && used[b] == 1);
+                seen[a][b]++;
+                seen[b][a]++;
+            }
+        }
+        for (int a = 0; a < n; a++) {
+            for (int b = 0; b < n; b++) {
+                assert_int_equal(seen[a][b], (a != b) ? 1 : 0);
+            }
+        }
+    }
+
+    struct clocktick_context ctx = clocktick_context_for('t');
+    int64_t results[10];
+    assert_int_equal(clocktick_run_handoff_test(&ctx, 1, 1, results, 10), clocktick_error_argument);
+    // Pinning to CPUs that do not exist fails before the threads spin
+    assert_int_equal(clocktick_run_handoff_test(&ctx, 100000, 100001, results, 10), clocktick_error_system);
+    struct clocktick_context realtime = clocktick_context_for('r');
+    assert_int_equal(clocktick_run_handoff_test(&realtime, 0, 1, results, 10), clocktick_error_clocktype);
+    int64_t median[4], p99[4];
+    struct handoff_matrix matrix = {.cpus = {3, 3}, .nbr_cpus = 2, .round_trips = 10, .median = median, .p99 = p99};
+    assert_int_equal(clocktick_run_handoff_matrix(&ctx, &matrix), clocktick_error_argument);
+}
+
+static void test_exit_cost(void **state) {
+    struct clocktick_context ctx = clocktick_context_for('t');
+    int64_t results[100];
+    int64_t lowest[16];
+    for (int k = 0; k < exit_cost_nbr_default_ops; k++) {
+        assert_int_equal(clocktick_run_exit_cost(&ctx, &exit_cost_default_ops[k], results, 100), clocktick_ok);
+        lowest[k] = INT64_MAX;
+        for (int i = 0; i < 100; i++) {
+            lowest[k] = (results[i] < lowest[k]) ? results[i] : lowest[k];
+        }
+        assert_true(lowest[k] > 0);
+    }
+    // cpuid is serializing, it is never cheaper than the control
+    assert_int_equal(exit_cost_default_ops[0].kind, 'n');
+    assert_int_equal(exit_cost_default_ops[1].kind, 'c');
+    assert_true(lowest[1] > lowest[0]);
+
+    struct exit_cost_op const unknown = {'x', 0, 0, "unknown"};
+    assert_int_equal(clocktick_run_exit_cost(&ctx, &unknown, results, 100), clocktick_error_argument);
+    struct clocktick_context mock = clocktick_context_for('m');
+    assert_int_equal(clocktick_run_exit_cost(&mock, &exit_cost_default_ops[0], results, 100), clocktick_error_clocktype);
+}
+
+static void test_throughput(void **state) {
+    // Mock clock goes up by 10 ns for each read after the first reads
+    struct clocktick_context ctx = clocktick_context_for('m');
+    uint32_t counts[20];
+    assert_int_equal(mock_get_timevalue(true), 0);
+    assert_int_equal(clocktick_run_throughput_test(&ctx, 100, counts, 20), clocktick_ok);
+    for (int i = 1; i < 20; i++) {
+        assert_int_equal(counts[i], 10);
+    }
+    // A jump over several windows leaves them empty
+    ctx.mock_clock = &jumping_clock;
+    jumping_clock(true);
+    assert_int_equal(clocktick_run_throughput_test(&ctx, 30000, counts, 20), clocktick_ok);
+    assert_int_equal(counts[0], 0);
+    assert_int_equal(counts[3], 1);
+    assert_int_equal(counts[4], 0);
+    assert_int_equal(clocktick_run_throughput_test(&ctx, 0, counts, 20), clocktick_error_argument);
+}
+
+static void write_file(char const *dir, char const *name, char const *content) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    assert_non_null(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static void read_file(char const *dir, char const *name, char *content, size_t const size) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    assert_non_null(f);
+    size_t const n = fread(content, 1, size - 1, f);
+    content[n] = '\0';
+    fclose(f);
+}
+
+static void test_flight_recorder(void **state) {
+    // A directory with the files of tracefs stands in for the kernel
+    char tracefs[] = "/tmp/test_cj_tracefs_XXXXXX";
+    assert_non_null(mkdtemp(tracefs));
+    char path[512];
+    snprintf(path, sizeof(path), "%s/options", tracefs);
+    assert_int_equal(mkdir(path, 0700), 0);
+    write_file(tracefs, "trace_marker", "");
+    write_file(tracefs, "tracing_on", "0\n");
+    write_file(tracefs, "options/overwrite", "0\n");
+    write_file(tracefs, "trace", "# tracer: nop\n");
+
+    struct clocktick_context ctx = clocktick_context_for('m');
+    ctx.mock_clock = &jumping_clock;
+    jumping_clock(true);
+    struct flight_recorder fr;
+    char content[1024];
+    struct clocktick_context ctx_t;
+    assert_int_equal(clocktick_init(&ctx_t, 't'), clocktick_ok);
+    assert_int_equal(flight_recorder_open(&fr, &ctx_t, tracefs, 2), clocktick_error_not_calibrated);
+    assert_int_equal(flight_recorder_open(&fr, &ctx, tracefs, 2), clocktick_ok);
+    read_file(tracefs, "tracing_on", content, sizeof(content));
+    assert_int_equal(content[0], '1');
+    read_file(tracefs, "options/overwrite", content, sizeof(content));
+    assert_int_equal(content[0], '1');
+
+    // Every diff of the jumping clock is above the threshold, tracing stops after 2
+    struct clocktick_jump_hook hook = {1000, &flight_recorder_mark, &fr};
+    int64_t results[4];
+    assert_int_equal(clocktick_run_highest_test_with_hook(&ctx, 10, results, 3, &hook), clocktick_ok);
+    assert_int_equal(results[0], 100000);
+    assert_int_equal(fr.nbr_hits, 2);
+    assert_true(fr.stopped);
+    read_file(tracefs, "tracing_on", content, sizeof(content));
+    assert_int_equal(content[0], '0');
+    read_file(tracefs, "trace_marker", content, sizeof(content));
+    assert_non_null(strstr(content, "clocktick_jumps: jump 2 of 100000 ns"));
+
+    snprintf(path, sizeof(path), "%s/saved.trace", tracefs);
+    assert_int_equal(flight_recorder_save(&fr, path), clocktick_ok);
+    read_file(tracefs, "saved.trace", content, sizeof(content));
+    assert_string_equal(content, "# tracer: nop\n");
+    flight_recorder_close(&fr);
+    read_file(tracefs, "options/overwrite", content, sizeof(content));
+    assert_int_equal(content[0], '0');
+
+    struct cumulative_test_results cumulative[10];
+    hook.callback = NULL;
+    assert_int_equal(clocktick_run_cumulative_test_with_hook(&ctx, 10, 0, cumulative, &hook), clocktick_error_argument);
+    assert_int_equal(clocktick_run_highest_test_with_hook(&ctx, 10, results, 3, &hook), clocktick_error_argument);
+
+    char const *const files[] = {"trace_marker", "tracing_on", "options/overwrite", "trace", "saved.trace", "options", ""};
+    for (unsigned int i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", tracefs, files[i]);
+        remove(path);
+    }
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(null_test_success),
@@ -416,6 +1309,7 @@ int main(void) {
         cmocka_unit_test(test_get_timevalue_in_ns),
         cmocka_unit_test(test_mock_get_timevalue),
         cmocka_unit_test(test_run_percentile_test),
+        cmocka_unit_test(test_run_percentile_test_streaming),
         cmocka_unit_test(test_run_highest_test),
         cmocka_unit_test(test_run_cumulative_test),
         cmocka_unit_test(test_rdtsc_vs_rdtscp),
@@ -423,6 +1317,26 @@ int main(void) {
         cmocka_unit_test(test_get_baseline),
         cmocka_unit_test(test_find_highest_values),
         cmocka_unit_test(test_find_highest_cumulative_values),
+        cmocka_unit_test(test_event_store),
+        cmocka_unit_test(test_find_highest_values_in_event_store),
+        cmocka_unit_test(test_run_cumulative_test_compact),
+        cmocka_unit_test(test_parse_cpu_list),
+        cmocka_unit_test(test_classify_correlated_stalls),
+        cmocka_unit_test(test_run_wakeup_test),
+        cmocka_unit_test(test_clocktick_context),
+        cmocka_unit_test(test_histogram),
+        cmocka_unit_test(test_run_burst),
+        cmocka_unit_test(test_run_sentinel),
+        cmocka_unit_test(test_simd_kernels),
+        cmocka_unit_test(test_histogram_series),
+        cmocka_unit_test(test_calibration_cache),
+        cmocka_unit_test(test_adaptive),
+        cmocka_unit_test(test_result_summary),
+        cmocka_unit_test(test_diff_store),
+        cmocka_unit_test(test_handoff),
+        cmocka_unit_test(test_exit_cost),
+        cmocka_unit_test(test_throughput),
+        cmocka_unit_test(test_flight_recorder),
     };
     initialize_cyc2ns_multiplier('p');
     return cmocka_run_group_tests(tests, NULL, NULL);
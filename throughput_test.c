@@ -0,0 +1,43 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include "throughput_test.h"
+
+// Writes the number of iterations of each window of window_ns to counts,
+// nbr_windows windows from the start. The loop does one compare and one
+// increment more than the percentile test, and one store per window.
+int clocktick_run_throughput_test(struct clocktick_context const *context, int64_t const window_ns, uint32_t *counts, uint64_t const nbr_windows) {
+    struct clocktick_context const ctx = *context;
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (!clocktick_units_in_ns(&ctx) && !ctx.cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    int64_t const window = clocktick_from_ns(&ctx, window_ns);
+    if (window <= 0 || nbr_windows == 0) {
+        return clocktick_error_argument;
+    }
+    uint64_t w = 0;
+    uint32_t count = 0;
+    int64_t next;
+    int64_t window_end = clocktick_get_timevalue(&ctx) + window;
+    while (w < nbr_windows) {
+        next = clocktick_get_timevalue(&ctx);
+        if (next >= window_end) {
+            counts[w++] = count;
+            count = 0;
+            window_end += window;
+            while (next >= window_end && w < nbr_windows) {
+                counts[w++] = 0;
+                window_end += window;
+            }
+        }
+        count++;
+    }
+    return clocktick_ok;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef THROUGHPUT_TEST_H
+#define THROUGHPUT_TEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "clocktick.h"
+
+// Throughput test: counts the iterations of the clock read loop in each
+// window of fixed length. SMT contention, frequency throttling or memory
+// bandwidth pressure make every iteration a little slower without making any
+// diff long enough to be seen as a jump, but they lower the number of
+// iterations per window. A window that the loop did not run in at all (a
+// jump longer than the window) gets 0 iterations.
+
+int clocktick_run_throughput_test(struct clocktick_context const *, int64_t const, uint32_t *, uint64_t const);
+
+#endif // THROUGHPUT_TEST_H
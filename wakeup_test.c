@@ -0,0 +1,88 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include "wakeup_test.h"
+
+char const *wakeup_method_name_n = "nanosleep";
+char const *wakeup_method_name_f = "timerfd";
+char const *wakeup_method_name_h = "hybrid";
+
+static int64_t get_monotonic(void) {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_nsec + s2ns(tp.tv_sec);
+}
+
+static struct timespec ns2timespec(int64_t const ns) {
+    struct timespec tp = {.tv_sec = ns / one_billion, .tv_nsec = ns % one_billion};
+    return tp;
+}
+
+static int sleep_until(int64_t const deadline_ns) {
+    struct timespec const tp = ns2timespec(deadline_ns);
+    int r;
+    while ((r = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL)) == EINTR) {
+    }
+    return (r == 0) ? clocktick_ok : clocktick_error_system;
+}
+
+static int timerfd_sleep_until(int const fd, int64_t const deadline_ns) {
+    struct itimerspec const its = {.it_interval = {0, 0}, .it_value = ns2timespec(deadline_ns)};
+    uint64_t expirations;
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) < 0 || \
+        read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return clocktick_error_system;
+    }
+    return clocktick_ok;
+}
+
+// Every period_ns, sleep until the next deadline and store how late the clock
+// shows we woke up. The deadline is translated to the measurement clock just
+// before sleeping, so errors in cyc2ns only scale with the sleep length.
+int clocktick_run_wakeup_test(struct clocktick_context const *context, char const method, int64_t const period_ns, int64_t *results, uint64_t const number_of_iterations) {
+    struct clocktick_context const ctx = *context;
+    if (method != 'n' && method != 'f' && method != 'h') {
+        return clocktick_error_argument;
+    }
+    int status = clocktick_check_clock(&ctx);
+    if (status < 0) {
+        return status;
+    }
+    if (!clocktick_units_in_ns(&ctx) && !ctx.cyc2ns_multiplier_initialized) {
+        return clocktick_error_not_calibrated;
+    }
+    int fd = -1;
+    if (method == 'f') {
+        fd = timerfd_create(CLOCK_MONOTONIC, 0);
+        if (fd < 0) {
+            return clocktick_error_system;
+        }
+    }
+    int64_t deadline = get_monotonic() + period_ns;
+    for (uint64_t i = 0; i < number_of_iterations && status == clocktick_ok; i++) {
+        int64_t now = clocktick_get_timevalue(&ctx);
+        int64_t expected = now + clocktick_from_ns(&ctx, deadline - get_monotonic());
+        if (method == 'n') {
+            status = sleep_until(deadline);
+        } else if (method == 'f') {
+            status = timerfd_sleep_until(fd, deadline);
+        } else {
+            status = sleep_until(deadline - hybrid_spin_ns);
+            while (clocktick_get_timevalue(&ctx) < expected) {
+            }
+        }
+        results[i] = clocktick_get_timevalue(&ctx) - expected;
+        deadline += period_ns;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return status;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2020 Nokia
+ * Licensed under the BSD 3-Clause License.
+ * SPDX-License-Identifier: BSD-3-Clause
+*/
+
+#ifndef WAKEUP_TEST_H
+#define WAKEUP_TEST_H
+
+#include <stdint.h>
+#include "clocktick.h"
+
+// Wakeup test: sleep until an absolute CLOCK_MONOTONIC deadline and measure
+// how late the thread wakes up with the selected clock, like cyclictest does.
+// The results are overshoots in clock units and go through the same
+// reporting as the percentile test. The method is 'n' for clock_nanosleep,
+// 'f' for timerfd and 'h' for hybrid.
+
+extern char const *wakeup_method_name_n;
+extern char const *wakeup_method_name_f;
+extern char const *wakeup_method_name_h;
+
+// Wake up this early in the hybrid method and spin for the rest
+enum { hybrid_spin_ns = 50000 };
+
+int clocktick_run_wakeup_test(struct clocktick_context const *, char const, int64_t const, int64_t *, uint64_t const);
+
+#endif // WAKEUP_TEST_H